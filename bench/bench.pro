@@ -0,0 +1,21 @@
+TEMPLATE = app
+TARGET = gnuflagbench
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += .. ../fuzz
+
+SOURCES += gnuflagbench.cpp \
+    ../fuzz/fuzztarget.cpp \
+    ../gnuflag.cpp
+
+HEADERS += \
+    ../gnuflag.h \
+    ../gnuflag_regex.h \
+    ../gnuflag_capture.h \
+    ../fuzz/fuzztarget.h
+
+# "make check" fails if a ratio, also of the fuzz corpus, got worse than the committed baseline allows
+check.commands = ./$$TARGET --baseline $$PWD/baseline.txt --corpus $$PWD/../fuzz/corpus
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,613 @@
+#include "gnuflag.h"
+#include "fuzztarget.h"
+
+#include <getopt.h>
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <new>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  // counters of the replaced global allocator, only updated while countAllocations is set
+  bool countAllocations = false;
+  unsigned long allocationCount = 0;
+  unsigned long allocationBytes = 0;
+}
+
+void *operator new ( std::size_t size )
+{
+  if ( countAllocations ) {
+    allocationCount++;
+    allocationBytes += size;
+  }
+  void *p = malloc( size ? size : 1 );
+  if ( !p )
+    throw std::bad_alloc();
+  return p;
+}
+
+// not inlined, otherwise gcc pairs the free() with the callers new expression and
+// warns about mismatched allocation functions
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete ( void *p ) noexcept
+{
+  free( p );
+}
+
+/**
+ * Measures the overhead of GnuFlag compared to a hand written getopt_long loop.
+ * Every scenario is a set of options plus a argv corpus, each engine parses the
+ * same corpus into the same kind of target variables.
+ */
+
+namespace {
+
+  enum OptionKind {
+    BoolOption,
+    IntOption,
+    StringOption
+  };
+
+  struct Scenario
+  {
+    std::string name;
+    int optionCount;
+    int shortOptions;              // < the first shortOptions options also get a short name
+    std::vector<std::string> args; // < argv without the program name
+    int iterationDivisor;          // < expensive scenarios run fewer iterations
+  };
+
+  OptionKind kindOf ( int i )
+  {
+    return static_cast<OptionKind>( i % 3 );
+  }
+
+  char shortNameOf ( int i )
+  {
+    static const char names[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    return i < 52 ? names[i] : 0;
+  }
+
+  std::string longNameOf ( int i )
+  {
+    return "option-" + std::to_string( i );
+  }
+
+  /**
+   * All option names and the variables the options write to
+   */
+  struct Targets
+  {
+    Targets ( const Scenario &sc )
+      : names( sc.optionCount ),
+        bools( new bool[sc.optionCount]() ),
+        ints( sc.optionCount, 0 ),
+        strings( sc.optionCount )
+    {
+      for ( int i = 0; i < sc.optionCount; i++ )
+        names[i] = longNameOf( i );
+    }
+
+    std::vector<std::string> names;
+    std::unique_ptr<bool[]> bools;
+    std::vector<int> ints;
+    std::vector<std::string> strings;
+  };
+
+  /**
+   * Mutable argv as required by getopt
+   */
+  struct Argv
+  {
+    Argv ( const Scenario &sc ) : storage( sc.args ) {
+      ptrs.push_back( const_cast<char *>( "bench" ) );
+      for ( std::string &arg : storage )
+        ptrs.push_back( &arg[0] );
+      ptrs.push_back( nullptr );
+    }
+
+    int argc ( ) const { return ptrs.size() - 1; }
+    char * const *argv ( ) { return ptrs.data(); }
+
+    std::vector<std::string> storage;
+    std::vector<char *> ptrs;
+  };
+
+  /**
+   * A option set as it would be written by hand for getopt_long
+   */
+  class RawGetopt
+  {
+  public:
+    RawGetopt ( const Scenario &sc, Targets &targets ) : _targets( targets ), _shortIndex( 256, -1 ) {
+      _shortopts = "+:";
+      for ( int i = 0; i < sc.optionCount; i++ ) {
+        int hasArg = kindOf( i ) == BoolOption ? no_argument : required_argument;
+        _longopts.push_back( { targets.names[i].c_str(), hasArg, nullptr, i } );
+        char c = i < sc.shortOptions ? shortNameOf( i ) : 0;
+        if ( c ) {
+          _shortopts += c;
+          if ( hasArg == required_argument )
+            _shortopts += ':';
+          _shortIndex[ (unsigned char) c ] = i;
+        }
+      }
+      _longopts.push_back( { 0, 0, 0, 0 } );
+    }
+
+    int parse ( int argc, char * const *argv ) {
+      opterr = 0;
+      optind = 0;
+      while ( true ) {
+        int longIndex = -1;
+        int c = getopt_long( argc, argv, _shortopts.c_str(), _longopts.data(), &longIndex );
+        if ( c == -1 )
+          break;
+        if ( c == '?' || c == ':' )
+          continue;
+
+        int i = longIndex >= 0 ? c : _shortIndex[ (unsigned char) c ];
+        switch ( kindOf( i ) ) {
+          case BoolOption:
+            _targets.bools[i] = true;
+            break;
+          case IntOption:
+            _targets.ints[i] = strtol( optarg, nullptr, 10 );
+            break;
+          case StringOption:
+            _targets.strings[i] = optarg;
+            break;
+        }
+      }
+      return optind;
+    }
+
+  private:
+    Targets &_targets;
+    std::string _shortopts;
+    std::vector<struct option> _longopts;
+    std::vector<int> _shortIndex;
+  };
+
+  std::vector<GnuFlag::CommandGroup> makeGroups ( const Scenario &sc, Targets &targets )
+  {
+    std::vector<GnuFlag::CommandOption> opts;
+    for ( int i = 0; i < sc.optionCount; i++ ) {
+      char shortName = i < sc.shortOptions ? shortNameOf( i ) : 0;
+      const char *name = targets.names[i].c_str();
+      switch ( kindOf( i ) ) {
+        case BoolOption:
+          opts.push_back( { name, shortName, GnuFlag::CommandOption::NoArgument, GnuFlag::BoolType( &targets.bools[i] ), "" } );
+          break;
+        case IntOption:
+          opts.push_back( { name, shortName, GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &targets.ints[i] ), "" } );
+          break;
+        case StringOption:
+          opts.push_back( { name, shortName, GnuFlag::CommandOption::RequiredArgument, GnuFlag::StringType( &targets.strings[i] ), "" } );
+          break;
+      }
+    }
+    return { GnuFlag::CommandGroup{ "Bench", opts } };
+  }
+
+  std::vector<std::string> argsFor ( int i )
+  {
+    std::string opt = "--" + longNameOf( i );
+    switch ( kindOf( i ) ) {
+      case BoolOption:
+        return { opt };
+      case IntOption:
+        return { opt, std::to_string( i * 7 ) };
+      case StringOption:
+        return { opt + "=value-" + std::to_string( i ) };
+    }
+    return {};
+  }
+
+  std::vector<Scenario> scenarios ( )
+  {
+    std::vector<Scenario> res;
+
+    Scenario small{ "small", 9, 9, {}, 1 };
+    for ( int i = 0; i < small.optionCount; i++ ) {
+      auto a = argsFor( i );
+      small.args.insert( small.args.end(), a.begin(), a.end() );
+    }
+    res.push_back( small );
+
+    // a big option set where the used options are spread over the whole table
+    Scenario large{ "large", 600, 0, {}, 1 };
+    for ( int i = 0; i < large.optionCount; i += 12 ) {
+      auto a = argsFor( i );
+      large.args.insert( large.args.end(), a.begin(), a.end() );
+    }
+    res.push_back( large );
+
+    // one cluster of short boolean flags
+    Scenario bundled{ "bundled", 52, 52, { "-" }, 1 };
+    for ( int i = 0; i < bundled.optionCount; i += 3 )
+      bundled.args[0] += shortNameOf( i );
+    res.push_back( bundled );
+
+    // worst cases seen in production, a single value of several megabytes
+    // where every copy shows up, and many unknown options that each make
+    // getopt scan the whole table
+    Scenario giant{ "giant-value", 3, 3, { "--" + longNameOf( 2 ) + "=" + std::string( 4 << 20, 'x' ) }, 200 };
+    res.push_back( giant );
+
+    Scenario unknown{ "unknown", 600, 0, {}, 10 };
+    for ( int i = 0; i < 50; i++ )
+      unknown.args.push_back( "--unknown-" + std::to_string( i ) );
+    res.push_back( unknown );
+
+    return res;
+  }
+
+  // every sample runs at least this long, so timer resolution and single interrupts
+  // do not dominate scenarios that take well below a microsecond
+  const double minSampleNs = 200000;
+
+  // a ratio only counts as a regression if it is still too high after subtracting this many MADs
+  const double madFactor = 3;
+
+  template <typename F>
+  double nsPerIteration ( int iterations, F &&f )
+  {
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < iterations; i++ )
+      f();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+    return double( ns ) / iterations;
+  }
+
+  double median ( std::vector<double> values )
+  {
+    std::sort( values.begin(), values.end() );
+    size_t mid = values.size() / 2;
+    if ( values.size() % 2 )
+      return values[mid];
+    return ( values[mid - 1] + values[mid] ) / 2;
+  }
+
+  /**
+   * Median absolute deviation, a spread measure that ignores single outliers
+   */
+  double mad ( const std::vector<double> &values, double med )
+  {
+    std::vector<double> dev;
+    for ( double v : values )
+      dev.push_back( std::fabs( v - med ) );
+    return median( dev );
+  }
+
+  struct Measurement
+  {
+    std::string key;  // < scenario/engine
+    double medianNs;
+    double madNs;
+    double ratio;     // < median ratio to the raw getopt loop of the same scenario
+    double ratioMad;
+    bool gated;       // < compared against the baseline
+  };
+
+  struct Engine
+  {
+    std::string name;
+    bool gated;       // < false if the ratio to getopt says nothing, e.g. for work that does not parse
+    std::function<void()> run;
+  };
+
+  /**
+   * Times all \a engines \a runs times. The engines are interleaved in every run and
+   * the ratio against the first engine is taken per run, so frequency changes
+   * and noise that hit the whole run cancel out. Each engine runs at least
+   * \a iterations times per sample, more if that is shorter than minSampleNs.
+   */
+  std::vector<Measurement> measure ( const std::string &scenario, int runs, int iterations, const std::vector<Engine> &engines )
+  {
+    std::vector<std::vector<double>> samples( engines.size() );
+    std::vector<std::vector<double>> ratios( engines.size() );
+    std::vector<int> engineIterations( engines.size(), iterations );
+
+    //warm up caches and branch predictors, the warm up also tells how long one iteration takes
+    for ( size_t e = 0; e < engines.size(); e++ ) {
+      double ns = nsPerIteration( iterations / 10 + 1, engines[e].run );
+      if ( ns > 0 && ns * iterations < minSampleNs )
+        engineIterations[e] = static_cast<int>( std::min( minSampleNs / ns, 1e8 ) ) + 1;
+    }
+
+    for ( int r = 0; r < runs; r++ ) {
+      for ( size_t e = 0; e < engines.size(); e++ ) {
+        samples[e].push_back( nsPerIteration( engineIterations[e], engines[e].run ) );
+        ratios[e].push_back( samples[e].back() / samples[0].back() );
+      }
+    }
+
+    std::vector<Measurement> res;
+    for ( size_t e = 0; e < engines.size(); e++ ) {
+      double med = median( samples[e] );
+      double ratio = median( ratios[e] );
+      res.push_back( Measurement{ scenario + "/" + engines[e].name, med, mad( samples[e], med ), ratio, mad( ratios[e], ratio ), engines[e].gated } );
+    }
+    return res;
+  }
+
+  struct AllocationBudget
+  {
+    std::string name;
+    unsigned long budget;  // < maximum number of allocations
+    std::function<void()> run;
+  };
+
+  /**
+   * Counts the allocations done by each scenario and reports every one
+   * that allocates more than its budget.
+   * \returns the number of scenarios over budget
+   */
+  int checkAllocations ( const std::vector<AllocationBudget> &scenarios )
+  {
+    int overBudget = 0;
+    printf( "\n%-32s %8s %10s %8s\n", "allocations", "count", "bytes", "budget" );
+    for ( const AllocationBudget &sc : scenarios ) {
+      allocationCount = allocationBytes = 0;
+      countAllocations = true;
+      sc.run();
+      countAllocations = false;
+
+      printf( "%-32s %8lu %10lu %8lu\n", sc.name.c_str(), allocationCount, allocationBytes, sc.budget );
+      if ( allocationCount > sc.budget ) {
+        printf( "OVER BUDGET %s: %lu allocations, budget %lu\n", sc.name.c_str(), allocationCount, sc.budget );
+        overBudget++;
+      }
+    }
+    return overBudget;
+  }
+
+  /**
+   * Reads a baseline file with "key ratio" pairs per line
+   */
+  bool readBaseline ( const std::string &file, std::map<std::string, double> &baseline )
+  {
+    std::ifstream in( file );
+    if ( !in )
+      return false;
+    std::string key;
+    double ratio;
+    while ( in >> key >> ratio )
+      baseline[key] = ratio;
+    return true;
+  }
+
+  /**
+   * Appends the names of the files in the fuzz corpus directory \a dir to \a files, sorted
+   */
+  bool corpusFiles ( const std::string &dir, std::vector<std::string> &files )
+  {
+    DIR *dp = opendir( dir.c_str() );
+    if ( !dp )
+      return false;
+    while ( struct dirent *ent = readdir( dp ) ) {
+      if ( ent->d_name[0] != '.' )
+        files.push_back( ent->d_name );
+    }
+    closedir( dp );
+    std::sort( files.begin(), files.end() );
+    return true;
+  }
+
+  bool writeBaseline ( const std::string &file, const std::vector<Measurement> &results )
+  {
+    std::ofstream out( file );
+    if ( !out )
+      return false;
+    for ( const Measurement &m : results ) {
+      if ( m.gated )
+        out << m.key << " " << m.ratio << "\n";
+    }
+    return out.good();
+  }
+}
+
+/**
+ * Without arguments the results are only printed. If a baseline is given the
+ * ratios are compared against it and the program fails if one got slower
+ * than the threshold allows, even after subtracting a few times its MAD so
+ * a noisy run does not count as a regression. Ratios are used instead of
+ * absolute times so the baseline can be shared between machines. renderHelp
+ * is measured but not gated, it does not parse and its ratio to getopt only
+ * follows the scenario. With a corpus directory every input the fuzzer in
+ * ../fuzz found to be slow is replayed and gated the same way.
+ */
+int main ( int argc, char *argv[] )
+{
+  int iterations = 2000;
+  int runs = 15;
+  int threshold = 25;
+  std::string baselineFile;
+  std::string writeBaselineFile;
+  std::string corpusDir;
+  bool help = false;
+
+  std::vector<GnuFlag::CommandGroup> options {
+    { "Benchmark", {
+        { "iterations", 'i', GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &iterations, iterations ), "Parses per sample." },
+        { "runs", 'r', GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &runs, runs ), "Samples per measurement." },
+        { "corpus", 'c', GnuFlag::CommandOption::RequiredArgument, GnuFlag::StringType( &corpusDir, nullptr, "DIR" ), "Also replay the fuzz corpus in DIR." }
+      }
+    }, { "Regression check", {
+        { "baseline", 'b', GnuFlag::CommandOption::RequiredArgument, GnuFlag::StringType( &baselineFile, nullptr, "FILE" ), "Compare against the ratios in FILE." },
+        { "threshold", 't', GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &threshold, threshold ), "Allowed slowdown in percent." },
+        { "write-baseline", 'w', GnuFlag::CommandOption::RequiredArgument, GnuFlag::StringType( &writeBaselineFile, nullptr, "FILE" ), "Store the measured ratios in FILE." },
+        { "help", 'h', GnuFlag::CommandOption::NoArgument, GnuFlag::BoolType( &help ), "Show this help." }
+      }
+    }
+  };
+
+  GnuFlag::parseCLI( argc, argv, options );
+  if ( help ) {
+    GnuFlag::renderHelp( options );
+    return 0;
+  }
+  iterations = std::max( 1, iterations );
+  runs = std::max( 1, runs );
+
+  std::vector<Measurement> results;
+
+  printf( "%-44s %12s %10s %8s %10s\n", "measurement", "median ns", "MAD ns", "ratio", "ratio MAD" );
+
+  for ( const Scenario &sc : scenarios() ) {
+    Targets targets( sc );
+    Argv args( sc );
+
+    RawGetopt raw( sc, targets );
+    std::vector<GnuFlag::CommandGroup> groups = makeGroups( sc, targets );
+    GnuFlag::OptionSet compiled( groups );
+
+    // the help and errors are written to std::cout and std::cerr, send them nowhere while measuring
+    std::ostringstream sink;
+    std::streambuf *coutBuf = std::cout.rdbuf( sink.rdbuf() );
+    std::streambuf *cerrBuf = std::cerr.rdbuf( sink.rdbuf() );
+
+    std::vector<Measurement> scResults = measure( sc.name, runs, std::max( 1, iterations / sc.iterationDivisor ), {
+      { "getopt",     true,  [&]() { raw.parse( args.argc(), args.argv() ); } },
+      { "parseCLI",   true,  [&]() { sink.str( std::string() ); GnuFlag::parseCLI( args.argc(), args.argv(), groups ); } },
+      { "OptionSet",  true,  [&]() { sink.str( std::string() ); compiled.parse( args.argc(), args.argv() ); } },
+      { "renderHelp", false, [&]() { sink.str( std::string() ); GnuFlag::renderHelp( groups ); } }
+    } );
+
+    std::cout.rdbuf( coutBuf );
+    std::cerr.rdbuf( cerrBuf );
+
+    for ( const Measurement &m : scResults ) {
+      printf( "%-44s %12.0f %10.0f %8.2f %10.2f\n", m.key.c_str(), m.medianNs, m.madNs, m.ratio, m.ratioMad );
+      results.push_back( m );
+    }
+  }
+
+  // the fuzz corpus, parsed against the options of the fuzz target
+  std::vector<std::string> corpus;
+  if ( corpusDir.size() && !corpusFiles( corpusDir, corpus ) ) {
+    fprintf( stderr, "Unable to read corpus %s\n", corpusDir.c_str() );
+    return 2;
+  }
+  for ( const std::string &file : corpus ) {
+    std::ifstream in( corpusDir + "/" + file, std::ios::binary );
+    std::string content( ( std::istreambuf_iterator<char>( in ) ), std::istreambuf_iterator<char>() );
+    GnuFlagFuzz::Argv args( GnuFlagFuzz::splitInput( reinterpret_cast<const uint8_t *>( content.data() ), content.size() ) );
+
+    std::vector<Measurement> fileResults = measure( "corpus/" + file, runs, std::max( 1, iterations / 10 ), {
+      { "getopt",    true, [&]() { GnuFlagFuzz::rawParseInput( args ); } },
+      { "OptionSet", true, [&]() { GnuFlagFuzz::parseInput( args ); } }
+    } );
+    for ( const Measurement &m : fileResults ) {
+      printf( "%-44s %12.0f %10.0f %8.2f %10.2f\n", m.key.c_str(), m.medianNs, m.madNs, m.ratio, m.ratioMad );
+      results.push_back( m );
+    }
+  }
+
+  // allocations are deterministic, so the budgets are exact limits
+  Scenario boolScenario{ "bools", 300, 0, {}, 1 };
+  for ( int i = 0; i < boolScenario.optionCount; i += 3 )
+    boolScenario.args.push_back( "--" + longNameOf( i ) );
+  Targets boolTargets( boolScenario );
+  Argv boolArgs( boolScenario );
+  std::vector<GnuFlag::CommandGroup> boolGroups = makeGroups( boolScenario, boolTargets );
+  GnuFlag::OptionSet boolSet( boolGroups );
+
+  Scenario smallScenario = scenarios().front();
+  Targets smallTargets( smallScenario );
+  Argv smallArgs( smallScenario );
+  std::vector<GnuFlag::CommandGroup> smallGroups = makeGroups( smallScenario, smallTargets );
+  GnuFlag::OptionSet smallSet( smallGroups );
+
+  std::string str;
+  int num = 0;
+  bool flag = false;
+  std::vector<std::string> list;
+  std::ostringstream sink;
+  std::string dumpBuffer;
+  dumpBuffer.reserve( 4096 );
+
+  // defaults longer than the small string buffer, unchanged so all are compared and skipped
+  std::string longStr = "a default value longer than the small string buffer";
+  int defNum = 123456789;
+  bool defFlag = true;
+  std::vector<GnuFlag::CommandGroup> defaultGroups { GnuFlag::CommandGroup{ "Defaults", {
+    { "long-string", 0, GnuFlag::CommandOption::RequiredArgument, GnuFlag::StringType( &longStr, "a default value longer than the small string buffer" ), "" },
+    { "number", 0, GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &defNum, 123456789 ), "" },
+    { "flag", 0, GnuFlag::CommandOption::NoArgument, GnuFlag::BoolType( &defFlag, GnuFlag::StoreTrue, true ), "" }
+  } } };
+
+  int overBudget = checkAllocations( {
+    { "OptionSet parse 100 bool flags", 0, [&]() { boolSet.parse( boolArgs.argc(), boolArgs.argv() ); } },
+    { "OptionSet parse small", 0, [&]() { smallSet.parse( smallArgs.argc(), smallArgs.argv() ); } },
+    { "parseCLI small", 7, [&]() { GnuFlag::parseCLI( smallArgs.argc(), smallArgs.argv(), smallGroups ); } },
+    // the single allocation is the output buffer of the sink
+    { "renderHelp small", 1, [&]() {
+        std::streambuf *coutBuf = std::cout.rdbuf( sink.rdbuf() );
+        GnuFlag::renderHelp( smallGroups );
+        std::cout.rdbuf( coutBuf );
+      } },
+    { "dumpConfig small", 0, [&]() {
+        GnuFlag::dumpConfig( smallGroups, dumpBuffer );
+        dumpBuffer.clear();
+      } },
+    // the single allocation is the scratch buffer growing for the long value, comparing
+    // with the defaults must not add one per option
+    { "dumpConfig changed only", 1, [&]() {
+        GnuFlag::dumpConfig( defaultGroups, dumpBuffer, GnuFlag::DumpText, GnuFlag::DumpChangedOnly );
+        dumpBuffer.clear();
+      } },
+    { "StringType", 0, [&]() { GnuFlag::StringType( &str, "default" ); } },
+    { "IntType", 0, [&]() { GnuFlag::IntType( &num, 10 ); } },
+    { "BoolType", 0, [&]() { GnuFlag::BoolType( &flag ); } },
+    { "StringContainerType", 0, [&]() { GnuFlag::StringContainerType( &list ); } }
+  } );
+
+  if ( writeBaselineFile.size() && !writeBaseline( writeBaselineFile, results ) ) {
+    fprintf( stderr, "Unable to write baseline %s\n", writeBaselineFile.c_str() );
+    return 2;
+  }
+
+  if ( baselineFile.empty() )
+    return overBudget ? 1 : 0;
+
+  std::map<std::string, double> baseline;
+  if ( !readBaseline( baselineFile, baseline ) ) {
+    fprintf( stderr, "Unable to read baseline %s\n", baselineFile.c_str() );
+    return 2;
+  }
+
+  int regressions = 0;
+  for ( const Measurement &m : results ) {
+    auto it = m.gated ? baseline.find( m.key ) : baseline.end();
+    if ( it == baseline.end() )
+      continue;
+
+    double allowed = it->second * ( 1.0 + threshold / 100.0 );
+    if ( m.ratio - madFactor * m.ratioMad > allowed ) {
+      printf( "REGRESSION %s: ratio %.2f (MAD %.2f), baseline %.2f, allowed %.2f\n", m.key.c_str(), m.ratio, m.ratioMad, it->second, allowed );
+      regressions++;
+    }
+  }
+
+  if ( regressions || overBudget )
+    return 1;
+
+  printf( "No regressions against %s\n", baselineFile.c_str() );
+  return 0;
+}
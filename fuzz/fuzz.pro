@@ -0,0 +1,22 @@
+TEMPLATE = app
+TARGET = gnuflagfuzz
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# libFuzzer comes with clang
+QMAKE_CC = clang
+QMAKE_CXX = clang++
+QMAKE_LINK = clang++
+QMAKE_CXXFLAGS += -fsanitize=fuzzer
+QMAKE_LFLAGS += -fsanitize=fuzzer
+
+INCLUDEPATH += ..
+
+SOURCES += gnuflagfuzz.cpp \
+    fuzztarget.cpp \
+    ../gnuflag.cpp
+
+HEADERS += \
+    fuzztarget.h \
+    ../gnuflag.h
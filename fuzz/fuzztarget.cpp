@@ -0,0 +1,204 @@
+#include "fuzztarget.h"
+#include "gnuflag.h"
+
+#include <getopt.h>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+
+namespace GnuFlagFuzz {
+
+namespace {
+
+  /**
+   * Drops everything written to it, most inputs make the parser complain
+   */
+  class NullBuffer : public std::streambuf
+  {
+  protected:
+    int overflow ( int c ) override { return c == traits_type::eof() ? traits_type::not_eof( c ) : c; }
+    std::streamsize xsputn ( const char *, std::streamsize n ) override { return n; }
+  };
+
+  /**
+   * The options every input is parsed against. Long names share prefixes so abbreviations
+   * get ambiguous, every letter is a short option so clusters can be long, and every Value
+   * type that does not leave the parser is present. RegexType and GlobPathListType are left
+   * out, their time is spent in std::regex and glob.
+   */
+  struct Target
+  {
+    Target ( );
+
+    int count = 0;
+    bool flag = false;
+    int number = 0;
+    std::vector<std::string> list;
+    std::string interpolated;
+    std::string utf8;
+    std::string optional;
+    std::string secret;
+    std::string str;
+
+    std::vector<std::string> fillerNames;
+    std::vector<std::string> fillerValues;
+    std::unique_ptr<bool[]> fillerFlags;
+    std::vector<GnuFlag::CommandGroup> groups;
+    std::unique_ptr<GnuFlag::OptionSet> set;
+    std::string initial;  // < snapshot every parse starts from, so targets do not grow over inputs
+
+    // the same options as a hand written getopt_long table
+    std::string shortopts;
+    std::vector<struct option> longopts;
+  };
+
+  const int fillerCount = 100;
+
+  Target::Target ( )
+    : fillerNames( fillerCount ),
+      fillerValues( fillerCount ),
+      fillerFlags( new bool[fillerCount]() )
+  {
+    using GnuFlag::CommandOption;
+    std::vector<CommandOption> named {
+      { "verbose",      'v', CommandOption::NoArgument, GnuFlag::CountType( &count ), "" },
+      { "version",      'V', CommandOption::NoArgument, GnuFlag::BoolType( &flag ), "" },
+      { "value",        'x', CommandOption::RequiredArgument, GnuFlag::IntType( &number ), "" },
+      { "values",       'l', CommandOption::RequiredArgument | CommandOption::Repeatable, GnuFlag::StringContainerType( &list ), "" },
+      { "value-string", 's', CommandOption::RequiredArgument | CommandOption::Interpolate, GnuFlag::StringType( &interpolated ), "" },
+      { "utf8",         'u', CommandOption::RequiredArgument, GnuFlag::Utf8StringType( &utf8 ), "" },
+      { "optional",     'o', CommandOption::OptionalArgument, GnuFlag::StringType( &optional, "default" ), "" },
+      { "secret",       'p', CommandOption::RequiredArgument | CommandOption::Secret, GnuFlag::StringType( &secret ), "" },
+      { "string",       'S', CommandOption::RequiredArgument | CommandOption::Interpolate, GnuFlag::StringType( &str ), "" }
+    };
+
+    std::string used;
+    for ( const CommandOption &opt : named )
+      used += opt.shortName;
+
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    const char *nextLetter = letters;
+    std::vector<CommandOption> filler;
+    for ( int i = 0; i < fillerCount; i++ ) {
+      while ( *nextLetter && used.find( *nextLetter ) != std::string::npos )
+        nextLetter++;
+      char shortName = *nextLetter ? *nextLetter++ : 0;
+      fillerNames[i] = "option-" + std::to_string( i );
+      if ( i % 2 )
+        filler.push_back( { fillerNames[i].c_str(), shortName, CommandOption::RequiredArgument | CommandOption::Interpolate, GnuFlag::StringType( &fillerValues[i] ), "" } );
+      else
+        filler.push_back( { fillerNames[i].c_str(), shortName, CommandOption::NoArgument, GnuFlag::BoolType( &fillerFlags[i] ), "" } );
+    }
+
+    groups.emplace_back( "Named", named, std::vector<GnuFlag::OptionAlias>{
+      { "verbosity", "verbose", GnuFlag::OptionAlias::Deprecated },
+      { "val", "value", GnuFlag::OptionAlias::NoFlags }
+    } );
+    groups.emplace_back( "Filler", filler );
+    set.reset( new GnuFlag::OptionSet( groups ) );
+    initial = set->snapshot();
+
+    auto hasArg = []( int flags ) {
+      switch ( flags & CommandOption::ArgumentTypeMask ) {
+        case CommandOption::RequiredArgument: return required_argument;
+        case CommandOption::OptionalArgument: return optional_argument;
+      }
+      return no_argument;
+    };
+    shortopts = "+:";
+    for ( const GnuFlag::CommandGroup &grp : groups ) {
+      for ( const CommandOption &opt : grp.options ) {
+        longopts.push_back( { opt.name, hasArg( opt.flags ), nullptr, 0 } );
+        if ( opt.shortName ) {
+          shortopts += opt.shortName;
+          if ( hasArg( opt.flags ) != no_argument )
+            shortopts += hasArg( opt.flags ) == required_argument ? ":" : "::";
+        }
+      }
+    }
+    for ( const GnuFlag::OptionAlias &alias : groups.front().aliases ) {
+      for ( const CommandOption &opt : named ) {
+        if ( strcmp( opt.name, alias.target ) == 0 )
+          longopts.push_back( { alias.name, hasArg( opt.flags ), nullptr, 0 } );
+      }
+    }
+    longopts.push_back( { 0, 0, 0, 0 } );
+  }
+
+  Target &target ( )
+  {
+    static Target t;
+    return t;
+  }
+}
+
+/**
+ * Splits a fuzzer input into arguments, one per line. Argument vectors can not
+ * contain a '\0' and lines keep the committed corpus readable.
+ */
+std::vector<std::string> splitInput ( const uint8_t *data, size_t size )
+{
+  std::vector<std::string> args;
+  const char *pos = reinterpret_cast<const char *>( data );
+  const char *end = pos + size;
+  while ( pos < end ) {
+    const char *eol = pos;
+    while ( eol < end && *eol != '\n' )
+      eol++;
+    args.emplace_back( pos, eol );
+    pos = eol + 1;
+  }
+  return args;
+}
+
+Argv::Argv ( const std::vector<std::string> &args )
+  : storage( args )
+{
+  ptrs.push_back( const_cast<char *>( "fuzz" ) );
+  for ( std::string &arg : storage ) {
+    // a '\0' would cut the argument short anyway, keep the sizes honest
+    arg.resize( strlen( arg.c_str() ) );
+    ptrs.push_back( &arg[0] );
+  }
+  ptrs.push_back( nullptr );
+}
+
+/**
+ * Parses \a args with the fuzz target options, starting from the same values every time.
+ * \returns what \ref GnuFlag::OptionSet::parse returns
+ */
+int parseInput ( Argv &args )
+{
+  Target &t = target();
+  t.set->restore( t.initial );
+
+  static NullBuffer nullBuffer;
+  std::streambuf *cerrBuf = std::cerr.rdbuf( &nullBuffer );
+  int res = t.set->parse( args.argc(), args.argv() );
+  std::cerr.rdbuf( cerrBuf );
+  return res;
+}
+
+/**
+ * Parses \a args with a plain getopt_long loop over the same options, the reference
+ * the latency of \ref parseInput is compared with
+ */
+int rawParseInput ( Argv &args )
+{
+  Target &t = target();
+  static std::string sink;
+  opterr = 0;
+  optind = 0;
+  while ( true ) {
+    int longIndex = -1;
+    int c = getopt_long( args.argc(), args.argv(), t.shortopts.c_str(), t.longopts.data(), &longIndex );
+    if ( c == -1 )
+      break;
+    if ( optarg )
+      sink = optarg;
+  }
+  return optind;
+}
+
+}
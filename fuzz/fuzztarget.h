@@ -0,0 +1,34 @@
+#ifndef GNUFLAG_FUZZTARGET_H
+#define GNUFLAG_FUZZTARGET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace GnuFlagFuzz {
+
+  // shared by the libFuzzer harness and the benchmark that replays the committed corpus
+
+  std::vector<std::string> splitInput ( const uint8_t *data, size_t size );
+
+  /**
+   * Mutable argv as required by getopt, argv[0] is a fixed program name
+   */
+  struct Argv
+  {
+    Argv ( const std::vector<std::string> &args );
+
+    int argc ( ) const { return ptrs.size() - 1; }
+    char * const *argv ( ) { return ptrs.data(); }
+
+    std::vector<std::string> storage;
+    std::vector<char *> ptrs;
+  };
+
+  int parseInput ( Argv &args );
+  int rawParseInput ( Argv &args );
+
+}
+
+#endif // GNUFLAG_FUZZTARGET_H
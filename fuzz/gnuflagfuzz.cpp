@@ -0,0 +1,87 @@
+#include "fuzztarget.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+/**
+ * libFuzzer harness for OptionSet::parse and the Value types, see fuzztarget.cpp for the options.
+ *
+ * Besides crashes it looks for inputs that make parsing slow or allocation heavy. If
+ * GNUFLAG_FUZZ_MAX_NS_PER_BYTE or GNUFLAG_FUZZ_MAX_ALLOCS_PER_BYTE is set, a input that needs
+ * more than that per input byte, on top of a fixed allowance, aborts. libFuzzer then stores it
+ * as a crash and -minimize_crash=1 shrinks it while it stays over the limit:
+ *
+ *   GNUFLAG_FUZZ_MAX_NS_PER_BYTE=100 ./gnuflagfuzz -max_len=4096 corpus
+ *   GNUFLAG_FUZZ_MAX_NS_PER_BYTE=100 ./gnuflagfuzz -minimize_crash=1 -runs=20000 crash-<sha1>
+ *
+ * Minimized inputs go to corpus/ under a name that says what they stress, the benchmark
+ * replays that directory and gates its latency against bench/baseline.txt.
+ * Build without other sanitizers when hunting for slow inputs, they dominate the timing.
+ */
+
+namespace {
+  bool countAllocations = false;
+  unsigned long allocationCount = 0;
+
+  // a single slow run can be a interrupt, only inputs that stay slow are reported
+  const int attempts = 3;
+  const double fixedNs = 50000;
+  const double fixedAllocations = 64;
+
+  double limitFromEnv ( const char *name )
+  {
+    const char *value = getenv( name );
+    return value ? atof( value ) : 0;
+  }
+}
+
+void *operator new ( std::size_t size )
+{
+  if ( countAllocations )
+    allocationCount++;
+  void *p = malloc( size ? size : 1 );
+  if ( !p )
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete ( void *p ) noexcept
+{
+  free( p );
+}
+
+extern "C" int LLVMFuzzerTestOneInput ( const uint8_t *data, size_t size )
+{
+  static const double maxNsPerByte = limitFromEnv( "GNUFLAG_FUZZ_MAX_NS_PER_BYTE" );
+  static const double maxAllocationsPerByte = limitFromEnv( "GNUFLAG_FUZZ_MAX_ALLOCS_PER_BYTE" );
+
+  const std::vector<std::string> args = GnuFlagFuzz::splitInput( data, size );
+  double bestNs = 0;
+  unsigned long allocations = 0;
+  for ( int i = 0; i < attempts; i++ ) {
+    GnuFlagFuzz::Argv argv( args );
+    allocationCount = 0;
+    countAllocations = true;
+    auto start = std::chrono::steady_clock::now();
+    GnuFlagFuzz::parseInput( argv );
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+    countAllocations = false;
+
+    allocations = allocationCount;
+    bestNs = i == 0 ? ns : std::min( bestNs, ns );
+    if ( !maxNsPerByte || bestNs <= fixedNs + maxNsPerByte * size )
+      break;
+  }
+
+  if ( maxNsPerByte && bestNs > fixedNs + maxNsPerByte * size ) {
+    fprintf( stderr, "slow input: %.0f ns for %zu bytes\n", bestNs, size );
+    abort();
+  }
+  if ( maxAllocationsPerByte && allocations > fixedAllocations + maxAllocationsPerByte * size ) {
+    fprintf( stderr, "allocation heavy input: %lu allocations for %zu bytes\n", allocations, size );
+    abort();
+  }
+  return 0;
+}
@@ -1,11 +1,40 @@
 #include "gnuflag.h"
+#include "gnuflag_regex.h"
+#include "gnuflag_capture.h"
 
 #include <getopt.h>
-#include <map>
+#include <glob.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <exception>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <thread>
 #include <utility>
 #include <string.h>
 
+// without exception support errors in the option definitions are stored in the
+// OptionSet instead, see OptionSet::isValid
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define GNUFLAG_FAIL(msg) throw Exception( msg )
+#else
+#define GNUFLAG_FAIL(msg) do { d->error = ( msg ); return; } while ( false )
+#endif
+
 namespace GnuFlag
 {
 
@@ -48,6 +77,285 @@ namespace {
     using OptType = struct option;
     opts.push_back(OptType{opt.name, has_arg, 0 ,0});
   }
+
+  template <typename T>
+  void saveRaw ( std::string &buf, const T &val )
+  {
+    buf.append( reinterpret_cast<const char *>( &val ), sizeof(T) );
+  }
+
+  /**
+   * Reads a \a T written by \ref saveRaw at \a pos.
+   * \returns the position behind it, or nullptr if \a pos is nullptr or less than sizeof(T) bytes are left before \a end
+   */
+  template <typename T>
+  const char *restoreRaw ( const char *pos, const char *end, T &val )
+  {
+    if ( !pos || size_t( end - pos ) < sizeof(T) )
+      return nullptr;
+    memcpy( &val, pos, sizeof(T) );
+    return pos + sizeof(T);
+  }
+
+  /**
+   * Continues the 64 bit FNV-1a hash \a hash with the \a len bytes at \a data
+   */
+  uint64_t fnv1a ( const char *data, size_t len, uint64_t hash = 14695981039346656037ULL )
+  {
+    for ( size_t i = 0; i < len; i++ ) {
+      hash ^= static_cast<unsigned char>( data[i] );
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  void appendNumber ( std::string &out, long val )
+  {
+    char buf[24];
+    int len = snprintf( buf, sizeof(buf), "%ld", val );
+    out.append( buf, len );
+  }
+
+  /**
+   * Checks if \a len bytes at \a str are well formed UTF-8 according to RFC 3629,
+   * overlong forms, surrogates and code points above U+10FFFF are rejected.
+   * ASCII runs are checked a machine word at a time, which the compiler can vectorize.
+   */
+  bool isValidUtf8 ( const char *str, size_t len )
+  {
+    const unsigned char *s   = reinterpret_cast<const unsigned char *>( str );
+    const unsigned char *end = s + len;
+
+    while ( s < end ) {
+      //fast path, skip 8 bytes at once as long as all of them are ASCII
+      while ( end - s >= 8 ) {
+        uint64_t word;
+        memcpy( &word, s, sizeof(word) );
+        if ( word & 0x8080808080808080ULL )
+          break;
+        s += 8;
+      }
+      if ( s == end )
+        break;
+
+      unsigned char c = *s;
+      if ( c < 0x80 ) {
+        s++;
+        continue;
+      }
+
+      int follow;
+      unsigned char min = 0x80, max = 0xBF; //allowed range of the first continuation byte
+      if ( c >= 0xC2 && c <= 0xDF ) {
+        follow = 1;
+      } else if ( c >= 0xE0 && c <= 0xEF ) {
+        follow = 2;
+        if ( c == 0xE0 ) min = 0xA0;      //overlong
+        else if ( c == 0xED ) max = 0x9F; //surrogates
+      } else if ( c >= 0xF0 && c <= 0xF4 ) {
+        follow = 3;
+        if ( c == 0xF0 ) min = 0x90;      //overlong
+        else if ( c == 0xF4 ) max = 0x8F; //above U+10FFFF
+      } else {
+        return false;
+      }
+
+      if ( end - s <= follow )
+        return false;
+      if ( s[1] < min || s[1] > max )
+        return false;
+      for ( int i = 2; i <= follow; i++ ) {
+        if ( ( s[i] & 0xC0 ) != 0x80 )
+          return false;
+      }
+      s += follow + 1;
+    }
+    return true;
+  }
+
+  /**
+   * Appends all paths matching \a pattern to \a paths, unsorted.
+   * \returns false if glob failed for a other reason than not finding anything
+   */
+  bool globInto ( const std::string &pattern, int flags, std::vector<std::string> &paths )
+  {
+    glob_t res;
+    int rc = glob( pattern.c_str(), flags | GLOB_NOSORT, nullptr, &res );
+    if ( rc == 0 ) {
+      for ( size_t i = 0; i < res.gl_pathc; i++ )
+        paths.push_back( res.gl_pathv[i] );
+    }
+    globfree( &res );
+    return rc == 0 || rc == GLOB_NOMATCH;
+  }
+
+  /**
+   * Appends \a dir and all directories below it to \a dirs. Every entry ends with
+   * a slash, a empty \a dir stands for the current directory. Hidden directories
+   * are skipped and symlinks are not followed, like bash does for globstar.
+   */
+  void collectDirs ( const std::string &dir, std::vector<std::string> &dirs )
+  {
+    dirs.push_back( dir );
+    for ( size_t i = dirs.size() - 1; i < dirs.size(); i++ ) {
+      const std::string curr = dirs[i];
+      DIR *dp = opendir( curr.empty() ? "." : curr.c_str() );
+      if ( !dp )
+        continue;
+
+      while ( struct dirent *ent = readdir( dp ) ) {
+        if ( ent->d_name[0] == '.' )
+          continue;
+
+        bool isDir = ent->d_type == DT_DIR;
+        if ( ent->d_type == DT_UNKNOWN ) {
+          struct stat st;
+          isDir = lstat( ( curr + ent->d_name ).c_str(), &st ) == 0 && S_ISDIR( st.st_mode );
+        }
+        if ( isDir )
+          dirs.push_back( curr + ent->d_name + "/" );
+      }
+      closedir( dp );
+    }
+  }
+
+  /**
+   * Returns \a path with the characters glob treats as special escaped by a backslash,
+   * so the path only matches itself when used as a pattern
+   */
+  std::string escapeGlob ( const std::string &path )
+  {
+    std::string res;
+    res.reserve( path.size() );
+    for ( char c : path ) {
+      if ( c == '*' || c == '?' || c == '[' || c == '\\' )
+        res += '\\';
+      res += c;
+    }
+    return res;
+  }
+
+  /**
+   * Expands \a pattern like the shell does, additionally a "**" path component
+   * matches any number of directories.
+   */
+  bool expandGlob ( const std::string &pattern, std::vector<std::string> &paths )
+  {
+    size_t pos = pattern.find( "**" );
+    bool recursive = pos != std::string::npos
+        && ( pos == 0 || pattern[pos - 1] == '/' )
+        && ( pos + 2 == pattern.size() || pattern[pos + 2] == '/' );
+
+    if ( !recursive )
+      return globInto( pattern, 0, paths );
+
+    std::string base = pattern.substr( 0, pos );
+    std::string rest = pos + 2 == pattern.size() ? std::string("*") : pattern.substr( pos + 3 );
+
+    //GLOB_MARK adds the trailing slash again
+    while ( base.size() > 1 && base.back() == '/' )
+      base.pop_back();
+
+    std::vector<std::string> baseDirs;
+    if ( base.empty() || base == "/" )
+      baseDirs.push_back( base );
+    else if ( !globInto( base, GLOB_ONLYDIR | GLOB_MARK, baseDirs ) )
+      return false;
+
+    std::vector<std::string> dirs;
+    for ( const std::string &dir : baseDirs )
+      collectDirs( dir, dirs );
+
+    //the directories are real names now, they must not be taken as a pattern again
+    for ( const std::string &dir : dirs ) {
+      if ( !expandGlob( escapeGlob( dir ) + rest, paths ) )
+        return false;
+    }
+    return true;
+  }
+
+  /**
+   * Adds the time since construction to a counter when going out of scope.
+   * Building with GNUFLAG_NO_STATS defined removes all timing code.
+   */
+  class StatsTimer
+  {
+  public:
+#ifndef GNUFLAG_NO_STATS
+    StatsTimer ( unsigned long long *target ) : _target( target ) {
+      if ( _target )
+        _start = std::chrono::steady_clock::now();
+    }
+    ~StatsTimer ( ) {
+      if ( _target )
+        *_target += std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - _start ).count();
+    }
+  private:
+    unsigned long long *_target;
+    std::chrono::steady_clock::time_point _start;
+#else
+    StatsTimer ( unsigned long long * ) { }
+#endif
+  };
+}
+
+namespace {
+  bool appendString ( const void *target, std::string &out )
+  {
+    out += *static_cast<const std::string *>( target );
+    return true;
+  }
+
+  bool appendInt ( const void *target, std::string &out )
+  {
+    appendNumber( out, *static_cast<const int *>( target ) );
+    return true;
+  }
+
+  bool appendBool ( const void *target, std::string &out )
+  {
+    out += *static_cast<const bool *>( target ) ? "true" : "false";
+    return true;
+  }
+
+  template <typename T>
+  void saveTarget ( const void *target, std::string &buf )
+  {
+    saveRaw( buf, *static_cast<const T *>( target ) );
+  }
+
+  template <typename T>
+  const char *restoreTarget ( void *target, const char *pos, const char *end )
+  {
+    return restoreRaw( pos, end, *static_cast<T *>( target ) );
+  }
+
+  void saveStringTarget ( const void *target, std::string &buf )
+  {
+    saveStringState( buf, *static_cast<const std::string *>( target ) );
+  }
+
+  const char *restoreStringTarget ( void *target, const char *pos, const char *end )
+  {
+    return restoreStringState( pos, end, *static_cast<std::string *>( target ) );
+  }
+
+  //the default data of string types is the default as C string, nullptr if there is none
+  bool isDefaultString ( const void *defaultData, const std::string &current )
+  {
+    return defaultData && current == static_cast<const char *>( defaultData );
+  }
+
+  //the defaults of numbers and booleans fit the small string buffer, so they have no isDefault
+  void clearCount ( void *target )
+  {
+    *static_cast<int *>( target ) = 0;
+  }
+
+  const ValueOps stringOps { &appendString, &saveStringTarget, &restoreStringTarget, &isDefaultString, nullptr, false };
+  const ValueOps intOps    { &appendInt, &saveTarget<int>, &restoreTarget<int>, nullptr, nullptr, false };
+  const ValueOps countOps  { &appendInt, &saveTarget<int>, &restoreTarget<int>, nullptr, &clearCount, true };
+  const ValueOps boolOps   { &appendBool, &saveTarget<bool>, &restoreTarget<bool>, nullptr, nullptr, false };
 }
 
 /**
@@ -60,10 +368,17 @@ namespace {
  * \param defValue takes a functor that returns the default value for the option as string
  * \param setter takes a functor that writes a target variable based on the argument input
  * \param argHint Gives a indicaton what type of data is accepted by the argument
+ * \param ops optional table of functions shared by all values of the type, e.g. to get the
+ *        current value of the target variable as string for dumping the configuration
+ * \param target the variable written by \a setter, passed to the functions in \a ops
+ * \param defaultData the default value in the form ValueOps::isDefault of \a ops expects it
  */
-Value::Value(DefValueFun &&defValue, SetterFun &&setter, const std::string argHint)
+Value::Value(DefValueFun &&defValue, SetterFun &&setter, const std::string argHint, const ValueOps *ops, void *target, const void *defaultData)
   : _defaultVal( std::move(defValue) ),
     _setter( std::move(setter) ),
+    _ops( ops ),
+    _target( target ),
+    _defaultData( defaultData ),
     _argHint(argHint)
 {
 
@@ -72,11 +387,12 @@ Value::Value(DefValueFun &&defValue, SetterFun &&setter, const std::string argHi
 /**
  * Calls the setter functor, with either the given argument or the optional argument
  * if the \a in parameter is null. Additionally it checks if the argument was already seen
- * before and fails if that \a Repeatable flag is not set
+ * before and fails if that \a Repeatable flag is not set, unless the type accepts every
+ * occurrence on its own like \sa CountType
  */
-bool Value::set(CommandOption *opt, const boost::optional<std::string> in)
+bool Value::set(CommandOption *opt, const boost::optional<std::string> &in)
 {
-  if ( _wasSet && !(opt->flags & CommandOption::Repeatable)) {
+  if ( _wasSet && !(opt->flags & CommandOption::Repeatable) && !(_ops && _ops->repeatable) ) {
     std::cerr << "Option "<<opt->name<<" can only be used once"<< std::endl;
     return false;
   }
@@ -103,6 +419,70 @@ boost::optional<std::string> Value::defaultValue() const
   return _defaultVal();
 }
 
+/**
+ * Appends the current value of the target variable as string to \a out.
+ * \returns false if the value type can not provide its current value
+ */
+bool Value::appendCurrentValue(std::string &out) const
+{
+  if ( !_ops || !_ops->appendCurrent )
+    return false;
+  return _ops->appendCurrent( _target, out );
+}
+
+/**
+ * Returns true if \a current, as written by \ref appendCurrentValue, equals the default value.
+ * Types with a ValueOps::isDefault compare without building the default string, all
+ * other types fall back to \ref defaultValue.
+ */
+bool Value::isDefaultValue(const std::string &current) const
+{
+  if ( _ops && _ops->isDefault )
+    return _ops->isDefault( _defaultData, current );
+  auto defVal = _defaultVal();
+  return defVal && *defVal == current;
+}
+
+/**
+ * Returns true if every occurrence of the option adds to the target, like for
+ * \sa StringContainerType or \sa CountType, instead of replacing its value
+ */
+bool Value::accumulates() const
+{
+  return _ops && _ops->clear;
+}
+
+/**
+ * Empties the target of a accumulating value, see \ref accumulates
+ */
+void Value::clearTarget()
+{
+  if ( _ops && _ops->clear )
+    _ops->clear( _target );
+}
+
+/**
+ * Appends the state of the target variable to \a buf, values without
+ * a save functor write nothing.
+ */
+void Value::saveState(std::string &buf) const
+{
+  if ( _ops && _ops->save )
+    _ops->save( _target, buf );
+}
+
+/**
+ * Restores the target variable from the state written by \ref saveState at \a pos,
+ * no byte at or behind \a end is read.
+ * \returns the position behind the consumed state, or nullptr if the state was cut off
+ */
+const char *Value::restoreState(const char *pos, const char *end)
+{
+  if ( _ops && _ops->restore )
+    return _ops->restore( _target, pos, end );
+  return pos;
+}
+
 /**
  * returns the hint for the input a command accepts,
  * used in the help
@@ -112,6 +492,53 @@ std::string Value::argHint() const
   return _argHint;
 }
 
+/**
+ * Forgets that the value was already set, so the next call to \ref set
+ * is treated like the first occurrence of the option again
+ */
+void Value::reset()
+{
+  _wasSet = false;
+}
+
+/**
+ * Appends \a size to the state buffer \a buf
+ */
+void saveSizeState(std::string &buf, size_t size)
+{
+  saveRaw( buf, size );
+}
+
+/**
+ * Appends \a str with its length to the state buffer \a buf
+ */
+void saveStringState(std::string &buf, const std::string &str)
+{
+  saveRaw( buf, str.size() );
+  buf.append( str );
+}
+
+/**
+ * Reads a size written by \ref saveSizeState
+ */
+const char *restoreSizeState(const char *pos, const char *end, size_t &size)
+{
+  return restoreRaw( pos, end, size );
+}
+
+/**
+ * Reads a string written by \ref saveStringState
+ */
+const char *restoreStringState(const char *pos, const char *end, std::string &str)
+{
+  size_t len = 0;
+  pos = restoreRaw( pos, end, len );
+  if ( !pos || size_t( end - pos ) < len )
+    return nullptr;
+  str.assign( pos, len );
+  return pos + len;
+}
+
 /**
  * Returns a \sa Value instance handling flags taking a string parameter
  */
@@ -127,7 +554,38 @@ Value StringType(std::string *target, const boost::optional<const char *> &defVa
         *target = *in;
       return in.operator bool();
     },
-    hint
+    hint,
+    &stringOps,
+    target,
+    defValue ? *defValue : nullptr
+  );
+}
+
+/**
+ * Returns a \sa Value instance handling flags taking a string parameter like \sa StringType,
+ * but rejects arguments that are not valid UTF-8 already while parsing
+ */
+Value Utf8StringType(std::string *target, const boost::optional<const char *> &defValue, const char *hint) {
+  return Value (
+    [defValue]() ->  boost::optional<std::string>{
+      if (!defValue || *defValue == nullptr)
+        return boost::optional<std::string>();
+      return std::string(*defValue);
+    },
+    [target]( CommandOption *opt, const boost::optional<std::string> &in ){
+      if (!in)
+        return false;
+      if ( !isValidUtf8( in->data(), in->size() ) ) {
+        std::cerr << "Argument: " << opt->name << " is not valid UTF-8."<<std::endl;
+        return false;
+      }
+      *target = *in;
+      return true;
+    },
+    hint,
+    &stringOps,
+    target,
+    defValue ? *defValue : nullptr
   );
 }
 
@@ -147,21 +605,110 @@ Value IntType(int *target, const boost::optional<int> &defValue) {
           if ( !in )
             return false;
 
-          try {
-            *target = std::stoi( *in );
-          } catch ( const std::invalid_argument &e ) {
+          //strtol instead of std::stoi, so no exceptions are required
+          const char *str = in->c_str();
+          char *end = nullptr;
+          errno = 0;
+          long val = strtol( str, &end, 10 );
+          if ( end == str ) {
             std::cerr << "Argument: " << opt->name << " is invalid."<<std::endl;
             return false;
-          } catch ( const std::out_of_range &e) {
+          } else if ( errno == ERANGE || val < INT_MIN || val > INT_MAX ) {
             std::cerr << "Argument: " << opt->name << " is out of range."<<std::endl;
             return false;
-          } catch ( ... ) {
-            std::cerr << "Unknown error while handling the argument " << opt->name << std::endl;
-            return false;
           }
+          *target = static_cast<int>( val );
           return true;
         },
-        "NUMBER"
+        "NUMBER",
+        &intOps,
+        target
+  );
+}
+
+/**
+ * Returns a \sa Value instance that increments \a target every time the option is seen,
+ * also inside bundled short options like -vvv. Every occurrence counts, with or without
+ * the \a Repeatable flag.
+ */
+Value CountType(int *target) {
+  return Value (
+    []() -> boost::optional<std::string> { return boost::optional<std::string>(); },
+    [target]( CommandOption *, const boost::optional<std::string> & ){
+      ++*target;
+      return true;
+    },
+    std::string(),
+    &countOps,
+    target
+  );
+}
+
+/**
+ * Returns a \sa Value instance that expands its argument as a path pattern and appends
+ * all matching paths to \a target. Besides the usual shell wildcards a "**" path
+ * component matches any number of directories. The paths of each pattern are sorted
+ * bytewise, so the result does not depend on the locale or the file system.
+ * Expanding the pattern in the program avoids hitting ARG_MAX with huge file lists.
+ */
+Value GlobPathListType(std::vector<std::string> *target, const char *hint) {
+  return Value (
+    []() -> boost::optional<std::string> { return boost::optional<std::string>(); },
+    [target]( CommandOption *opt, const boost::optional<std::string> &in ){
+      if (!in)
+        return false;
+
+      std::vector<std::string> paths;
+      if ( !expandGlob( *in, paths ) ) {
+        std::cerr << "Argument: " << opt->name << " could not be expanded."<<std::endl;
+        return false;
+      }
+      if ( paths.empty() ) {
+        std::cerr << "Argument: " << opt->name << " does not match any file."<<std::endl;
+        return false;
+      }
+
+      std::sort( paths.begin(), paths.end() );
+      paths.erase( std::unique( paths.begin(), paths.end() ), paths.end() );
+
+      target->reserve( target->size() + paths.size() );
+      target->insert( target->end(), std::make_move_iterator( paths.begin() ), std::make_move_iterator( paths.end() ) );
+      return true;
+    },
+    hint,
+    &StringContainerOps<std::vector<std::string>>::ops,
+    target
+  );
+}
+
+/**
+ * Returns a \sa Value instance that compiles its argument into a regular expression
+ * using \a flags. The pattern is compiled exactly once while parsing and shared
+ * as immutable object, so it can be handed to all users without recompiling it.
+ * Invalid patterns are rejected with the error reported by std::regex.
+ * Without exception support invalid patterns terminate the program, std::regex has
+ * no other way to report them.
+ */
+Value RegexType(SharedRegex *target, std::regex::flag_type flags, const char *hint) {
+  return Value (
+    []() -> boost::optional<std::string> { return boost::optional<std::string>(); },
+    [target, flags]( CommandOption *opt, const boost::optional<std::string> &in ){
+      if (!in)
+        return false;
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+      try {
+        *target = std::make_shared<const std::regex>( *in, flags );
+      } catch ( const std::regex_error &e ) {
+        std::cerr << "Argument: " << opt->name << " is not a valid regular expression: " << e.what() << std::endl;
+        return false;
+      }
+#else
+      (void)opt;
+      *target = std::make_shared<const std::regex>( *in, flags );
+#endif
+      return true;
+    },
+    hint
   );
 }
 
@@ -179,67 +726,531 @@ Value BoolType(bool *target, StoreFlag store, const boost::optional<bool> &defVa
    [target, store]( CommandOption *, const boost::optional<std::string> &){
       *target = (store == StoreTrue);
       return true;
-    }
+    },
+    std::string(),
+    &boolOps,
+    target
   );
 }
 
 /**
- * Parses the command line arguments based on \a options.
- * \returns The first index in argv that was not parsed
+ * @class OptionSet
+ * Precompiled form of a list of \sa CommandGroup. All lookup tables required by getopt
+ * are built only once in the constructor, so the same set can be used to parse
+ * many argument vectors without paying for the setup again.
  */
-int parseCLI(const int argc, char * const *argv, const std::vector<CommandGroup> &options)
+struct OptionSet::Private
 {
   // the short options string as used int getopt
   // + - do not permute, stop at the 1st nonoption, which is the command
   // : - return : to indicate missing arg, not ?
-  std::string shortopts( "+:" );
+  std::string shortopts;
 
   // the set of long options
   std::vector<struct option> longopts;
 
-  //build a complete list and a long and short option index so we can
-  //easily get to the CommandOption
+  //a complete list and flat indexes so we can easily get to the CommandOption,
+  //all of them refer to options by their position in allOpts
   std::vector<CommandOption> allOpts;
-  std::map<std::string, int> longOptIndex;  //we do not actually need that index other than checking for dups
-  std::map<char, int>        shortOptIndex;
+  struct LongOptRef
+  {
+    int option;  //index in allOpts
+    int alias;   //index in aliases, -1 if the entry is not a alias
+  };
+  std::vector<LongOptRef>    longOptIndex;       //maps a index in longopts to allOpts
+  int                        shortOptIndex[256]; //maps a short option character to allOpts, -1 if unused
+
+  struct Alias
+  {
+    const char *name;
+    int target;       //index in allOpts
+    int flags;
+    bool warned;      //deprecation warnings are only shown once
+  };
+  std::vector<Alias> aliases;
+
+  //all long names including aliases, sorted by name
+  struct NameRef
+  {
+    const char *name;
+    int option;       //index in allOpts
+  };
+  std::vector<NameRef> sortedNames;
+
+  //number of times each option in allOpts was seen, empty if not recording
+  std::vector<unsigned long> hits;
+
+  ParseTracer *tracer = nullptr;
+
+  //error in the option definitions, only used without exception support
+  std::string error;
+
+  bool collectStats = false;
+  ParseStats stats;
+  StatsCallback statsCallback;
+
+  //arguments with ${name} references, applied after all other options
+  struct Deferred
+  {
+    int option;       //index in allOpts
+    int argIndex;
+    const char *raw;  //the unexpanded argument, points into argv
+  };
+  std::vector<Deferred> deferred;
+
+  //set for every option that had its setter called since the first subsystem was added, unlike
+  //Value::_wasSet this survives multiple parse calls, e.g. flag files followed by argv.
+  //Empty as long as there are no subsystems, so plain parsing does not pay for it
+  std::vector<bool> supplied;
+
+  struct SubsystemState
+  {
+    Subsystem subsystem;
+    bool initialized;
+  };
+  std::vector<SubsystemState> subsystems;
+
+  //once flag files are loaded every value given to a accumulating option is logged with the file
+  //it came from, so a FlagFileWatcher can rebuild such a option when only one file changed
+  struct Contribution
+  {
+    int option;       //index in allOpts, -1 marks where a flag file was applied
+    int source;       //index in sources, -1 if the value did not come from a flag file
+    boost::optional<std::string> arg;
+  };
+  bool trackSources = false;
+  int currentSource = -1;
+  std::vector<std::string> sources;            //flag file paths
+  std::vector<std::string> baseStates;         //state of accumulating options before tracking started
+  std::vector<Contribution> contributions;     //in the order the values were applied
+  std::vector<Contribution> *collecting = nullptr; //if set parseArgs only collects the values
+
+  bool accumulates ( int index ) const
+  {
+    return allOpts[index].value.accumulates() || allOpts[index].flags & CommandOption::Repeatable;
+  }
+  void startSourceTracking ( );
+  int sourceIndex ( const std::string &path );
+  void collectValues ( int source, std::vector<std::string> &args, std::vector<Contribution> &out );
+  void replaceSource ( int source, std::vector<Contribution> &&fresh );
+  void rebuildOption ( int index );
+
+  void buildLookupTables ( const std::vector<int> &order );
+  int parseArgs ( const int argc, char * const *argv, ParseStats *stats );
+  void applyValue ( int index, const boost::optional<std::string> &arg, int argIndex, ParseStats *stats );
+  void applyDeferred ( ParseStats *stats );
+  int findLongOption ( const char *name, size_t len ) const;
+  void redactSecrets ( std::vector<std::string> &args ) const;
+};
+
+/**
+ * (Re)builds the getopt tables, the options are added in the sequence given by \a order.
+ * getopt scans both tables front to back, so options placed first are found faster.
+ */
+void OptionSet::Private::buildLookupTables( const std::vector<int> &order )
+{
+  shortopts = "+:";
+  longopts.clear();
+  longOptIndex.clear();
+
+  for ( int idx : order ) {
+    const CommandOption &opt = allOpts[idx];
+    if ( opt.name ) {
+      appendToLongOptions( opt, longopts );
+      longOptIndex.push_back( LongOptRef{ idx, -1 } );
+    }
+    appendToOptString( opt, shortopts );
+  }
+
+  //aliases are expected to be rare, they go behind all regular options
+  for ( size_t i = 0; i < aliases.size(); i++ ) {
+    appendToLongOptions( allOpts[aliases[i].target], longopts );
+    longopts.back().name = aliases[i].name;
+    longOptIndex.push_back( LongOptRef{ aliases[i].target, int( i ) } );
+  }
+
+  //the long options always need to end with a set of zeros
+  longopts.push_back({0, 0, 0, 0});
+}
+
+/**
+ * Compiles \a options into the lookup tables used by \ref parse.
+ * Throws a \sa Exception if the options are inconsistent, when built
+ * without exception support \ref isValid has to be checked instead.
+ */
+OptionSet::OptionSet(const std::vector<CommandGroup> &options)
+  : d( new Private )
+{
+  StatsTimer timer( &d->stats.buildNs );
+  std::fill( std::begin(d->shortOptIndex), std::end(d->shortOptIndex), -1 );
+
+  size_t optCount = 0;
+  for ( const CommandGroup &grp : options )
+    optCount += grp.options.size();
+
+  d->allOpts.reserve( optCount );
+  d->longopts.reserve( optCount + 1 );
+  d->longOptIndex.reserve( optCount );
+
+  std::vector<Private::NameRef> &longNames = d->sortedNames;
+  longNames.reserve( optCount );
 
   for ( const CommandGroup &grp : options ) {
     for ( const CommandOption &currOpt : grp.options ) {
-      allOpts.push_back( currOpt );
+      d->allOpts.push_back( currOpt );
 
-      int allOptIndex = allOpts.size() - 1;
+      int allOptIndex = d->allOpts.size() - 1;
 
       if ( currOpt.flags & CommandOption::RequiredArgument && currOpt.flags &  CommandOption::OptionalArgument ) {
-        throw Exception("Argument can either be Required or Optional");
+        GNUFLAG_FAIL("Argument can either be Required or Optional");
       }
 
       if ( currOpt.name ) {
-        if ( !longOptIndex.insert( { currOpt.name, allOptIndex } ).second) {
-          throw Exception("Duplicate long option <insertnamehere>");
-        }
-        appendToLongOptions( currOpt, longopts );
+        longNames.push_back( Private::NameRef{ currOpt.name, allOptIndex } );
       }
 
       if ( currOpt.shortName ) {
-        if ( !shortOptIndex.insert( { currOpt.shortName, allOptIndex } ).second) {
-          throw Exception("Duplicate short option <insertnamehere>");
+        int &slot = d->shortOptIndex[ (unsigned char) currOpt.shortName ];
+        if ( slot != -1 ) {
+          GNUFLAG_FAIL( std::string("Duplicate short option ") + currOpt.shortName );
         }
-        appendToOptString( currOpt, shortopts );
+        slot = allOptIndex;
       }
-      allOptIndex++;
     }
   }
 
-  //the long options always need to end with a set of zeros
-  longopts.push_back({0, 0, 0, 0});
+  for ( const CommandGroup &grp : options ) {
+    for ( const OptionAlias &alias : grp.aliases ) {
+      auto it = std::find_if( d->allOpts.begin(), d->allOpts.end(), [&alias]( const CommandOption &opt ){
+        return opt.name && alias.target && strcmp( opt.name, alias.target ) == 0;
+      } );
+      if ( !alias.name || it == d->allOpts.end() ) {
+        GNUFLAG_FAIL( std::string("Alias ") + ( alias.name ? alias.name : "" ) + " points to a unknown option" );
+      }
+      d->aliases.push_back( Private::Alias{ alias.name, int( it - d->allOpts.begin() ), alias.flags, false } );
+      longNames.push_back( Private::NameRef{ alias.name, d->aliases.back().target } );
+    }
+  }
 
-  //setup getopt
+  //check for duplicate long options, the sorted names are kept for prefix queries
+  std::sort( longNames.begin(), longNames.end(), []( const Private::NameRef &a, const Private::NameRef &b ){ return strcmp( a.name, b.name ) < 0; } );
+  auto dup = std::adjacent_find( longNames.begin(), longNames.end(), []( const Private::NameRef &a, const Private::NameRef &b ){ return strcmp( a.name, b.name ) == 0; } );
+  if ( dup != longNames.end() ) {
+    GNUFLAG_FAIL( std::string("Duplicate long option ") + dup->name );
+  }
+
+  std::vector<int> order( d->allOpts.size() );
+  for ( size_t i = 0; i < order.size(); i++ )
+    order[i] = i;
+  d->buildLookupTables( order );
+}
+
+OptionSet::OptionSet(OptionSet &&other) = default;
+
+OptionSet::~OptionSet() = default;
+
+/**
+ * Calls the setter of the option at \a index with \a arg, \a argIndex is the
+ * position in argv the value came from.
+ */
+void OptionSet::Private::applyValue( int index, const boost::optional<std::string> &arg, int argIndex, ParseStats *stats )
+{
+  if ( collecting ) {
+    collecting->push_back( Contribution{ index, currentSource, arg } );
+    return;
+  }
+
+  if ( tracer )
+    tracer->record( ParseTracer::SetterBegin, &allOpts[index], argIndex );
+
+  if ( stats ) {
+    unsigned long long setterNs = 0;
+    {
+      StatsTimer timer( &setterNs );
+      allOpts[index].value.set( &allOpts[index], arg );
+    }
+    stats->setterNs += setterNs;
+    stats->options[index].calls++;
+    stats->options[index].setterNs += setterNs;
+  } else {
+    allOpts[index].value.set( &allOpts[index], arg );
+  }
+  if ( !supplied.empty() )
+    supplied[index] = true;
+  if ( trackSources && accumulates( index ) )
+    contributions.push_back( Contribution{ index, currentSource, arg } );
+
+  if ( tracer )
+    tracer->record( ParseTracer::SetterEnd, &allOpts[index], argIndex );
+}
+
+/**
+ * Returns the index in allOpts of the option or alias with the long name
+ * given by the \a len characters at \a name, or -1
+ */
+int OptionSet::Private::findLongOption( const char *name, size_t len ) const
+{
+  auto it = std::lower_bound( sortedNames.begin(), sortedNames.end(), std::make_pair( name, len ), []( const NameRef &ref, const std::pair<const char *, size_t> &key ){
+    //if the first len characters match ref.name is not smaller than the key
+    return strncmp( ref.name, key.first, key.second ) < 0;
+  } );
+  if ( it != sortedNames.end() && strncmp( it->name, name, len ) == 0 && it->name[len] == '\0' )
+    return it->option;
+  return -1;
+}
+
+/**
+ * Starts logging the values of accumulating options, see \a Contribution. The current state of
+ * those options is kept, it is what a rebuild in \ref rebuildOption starts from.
+ */
+void OptionSet::Private::startSourceTracking()
+{
+  if ( trackSources )
+    return;
+  trackSources = true;
+  baseStates.resize( allOpts.size() );
+  for ( size_t i = 0; i < allOpts.size(); i++ ) {
+    if ( accumulates( i ) )
+      allOpts[i].value.saveState( baseStates[i] );
+  }
+}
+
+/**
+ * Returns the index of the flag file \a path in sources, it is added if it is not known yet
+ */
+int OptionSet::Private::sourceIndex( const std::string &path )
+{
+  auto it = std::find( sources.begin(), sources.end(), path );
+  if ( it != sources.end() )
+    return it - sources.begin();
+  sources.push_back( path );
+  return sources.size() - 1;
+}
+
+/**
+ * Parses \a args, laid out like argv, as the content of \a source without calling any setter,
+ * the values are appended to \a out instead.
+ */
+void OptionSet::Private::collectValues( int source, std::vector<std::string> &args, std::vector<Contribution> &out )
+{
+  std::vector<char *> argv;
+  argv.reserve( args.size() + 1 );
+  for ( std::string &arg : args )
+    argv.push_back( &arg[0] );
+  argv.push_back( nullptr );
+
+  collecting = &out;
+  currentSource = source;
+  parseArgs( argv.size() - 1, argv.data(), nullptr );
+  collecting = nullptr;
+  currentSource = -1;
+}
+
+/**
+ * Replaces the values logged for \a source by \a fresh. They take the place the old ones
+ * had, so values from other files and the command line keep their order around them.
+ */
+void OptionSet::Private::replaceSource( int source, std::vector<Contribution> &&fresh )
+{
+  std::vector<Contribution> res;
+  res.reserve( contributions.size() + fresh.size() + 1 );
+  bool placed = false;
+  for ( Contribution &c : contributions ) {
+    if ( c.source != source ) {
+      res.push_back( std::move( c ) );
+    } else if ( c.option < 0 && !placed ) {
+      res.push_back( std::move( c ) );
+      std::move( fresh.begin(), fresh.end(), std::back_inserter( res ) );
+      placed = true;
+    }
+  }
+  if ( !placed ) {
+    res.push_back( Contribution{ -1, source, boost::none } );
+    std::move( fresh.begin(), fresh.end(), std::back_inserter( res ) );
+  }
+  contributions.swap( res );
+}
+
+/**
+ * Sets the accumulating option at \a index back to the state it had before flag files were
+ * involved and applies all values logged for it again, in order.
+ * Values that can not save their state get the logged values on top of their current one.
+ */
+void OptionSet::Private::rebuildOption( int index )
+{
+  CommandOption &opt = allOpts[index];
+  opt.value.restoreState( baseStates[index].data(), baseStates[index].data() + baseStates[index].size() );
+  for ( const Contribution &c : contributions ) {
+    if ( c.option != index )
+      continue;
+    opt.value.reset();
+    opt.value.set( &opt, c.arg );
+  }
+  if ( !supplied.empty() )
+    supplied[index] = true;
+}
+
+namespace {
+  /**
+   * Calls \a f with the name of every ${name} reference in \a str and \a literal with the text
+   * between them. Stops and returns false as soon as one of the callbacks does.
+   */
+  template <typename Ref, typename Literal>
+  bool forEachReference ( const char *str, Ref &&ref, Literal &&literal )
+  {
+    while ( const char *start = strstr( str, "${" ) ) {
+      const char *end = strchr( start + 2, '}' );
+      if ( !end )
+        break;
+      if ( !literal( str, start - str ) || !ref( start + 2, end - start - 2 ) )
+        return false;
+      str = end + 1;
+    }
+    return literal( str, strlen( str ) );
+  }
+}
+
+/**
+ * Expands the ${name} references in all deferred arguments and passes them to the setters.
+ * A name refers to a option if one with that long name exists, otherwise to a environment variable.
+ * Options referring to each other form a graph that is walked depth first, so every value is
+ * expanded exactly once and only after the values it depends on. All expansions are written into
+ * a single buffer. Values that are part of a cycle, refer to unknown names or to options that can
+ * not provide their current value, or depend on such a value are not applied, each one is reported.
+ */
+void OptionSet::Private::applyDeferred( ParseStats *stats )
+{
+  enum State { Unvisited, InProgress, Done, Failed };
+  std::vector<State> state( deferred.size(), Unvisited );
+  std::vector<bool> reported( deferred.size(), false ); //the reason for the failure was printed
+  std::vector<size_t> path;                             //values currently in progress
+  std::vector<std::pair<size_t, size_t>> spans( deferred.size() ); //offset and length in arena
+
+  size_t rawSize = 0;
+  for ( const Deferred &def : deferred )
+    rawSize += strlen( def.raw );
+  std::string arena;
+  arena.reserve( rawSize * 2 );
+
+  //the last occurrence of a option provides its value
+  auto deferredFor = [this]( int option ) {
+    for ( size_t i = deferred.size(); i > 0; i-- ) {
+      if ( deferred[i - 1].option == option )
+        return int( i - 1 );
+    }
+    return -1;
+  };
+
+  std::function<bool( size_t )> expand = [&]( size_t i ) -> bool {
+    if ( state[i] == Done )
+      return true;
+    if ( state[i] == Failed )
+      return false;
+
+    const char *optName = allOpts[deferred[i].option].name;
+    if ( state[i] == InProgress ) {
+      //everything on the path from the first visit of i on is part of the cycle
+      std::cerr << "Cyclic reference between the values of";
+      for ( auto it = std::find( path.begin(), path.end(), i ); it != path.end(); ++it ) {
+        std::cerr << " " << allOpts[deferred[*it].option].name;
+        reported[*it] = true;
+      }
+      std::cerr << std::endl;
+      return false;
+    }
+    state[i] = InProgress;
+    path.push_back( i );
+
+    //first make sure everything this value refers to is expanded
+    bool ok = forEachReference( deferred[i].raw, [&]( const char *name, size_t len ) {
+      int opt = findLongOption( name, len );
+      int dep = opt >= 0 ? deferredFor( opt ) : -1;
+      if ( dep >= 0 )
+        return expand( dep );
+      if ( opt < 0 && !getenv( std::string( name, len ).c_str() ) ) {
+        std::cerr << "Unknown variable ${" << std::string( name, len ) << "} in the value of " << optName << std::endl;
+        reported[i] = true;
+        return false;
+      }
+      if ( opt >= 0 ) {
+        //only a probe, the buffer is cut back right away
+        size_t mark = arena.size();
+        bool readable = allOpts[opt].value.appendCurrentValue( arena );
+        arena.resize( mark );
+        if ( !readable ) {
+          std::cerr << "Option " << allOpts[opt].name << " referenced in the value of " << optName << " can not provide its value" << std::endl;
+          reported[i] = true;
+          return false;
+        }
+      }
+      return true;
+    }, []( const char *, size_t ) { return true; } );
+
+    path.pop_back();
+    if ( !ok ) {
+      state[i] = Failed;
+      return false;
+    }
+
+    //now the value can be written in one go
+    size_t start = arena.size();
+    forEachReference( deferred[i].raw, [&]( const char *name, size_t len ) {
+      int opt = findLongOption( name, len );
+      int dep = opt >= 0 ? deferredFor( opt ) : -1;
+      if ( dep >= 0 )
+        arena.append( arena, spans[dep].first, spans[dep].second );
+      else if ( opt >= 0 )
+        allOpts[opt].value.appendCurrentValue( arena );
+      else
+        arena += getenv( std::string( name, len ).c_str() );
+      return true;
+    }, [&]( const char *text, size_t len ) {
+      arena.append( text, len );
+      return true;
+    } );
+
+    spans[i] = std::make_pair( start, arena.size() - start );
+    state[i] = Done;
+    return true;
+  };
+
+  for ( size_t i = 0; i < deferred.size(); i++ ) {
+    if ( !expand( i ) && !reported[i] ) {
+      reported[i] = true;
+      std::cerr << "Value of " << allOpts[deferred[i].option].name << " not applied, it refers to a value that could not be expanded" << std::endl;
+    }
+  }
+
+  //apply in the order the arguments were given
+  for ( size_t i = 0; i < deferred.size(); i++ ) {
+    if ( state[i] != Done )
+      continue;
+
+    boost::optional<std::string> arg;
+    if ( spans[i].second )
+      arg = arena.substr( spans[i].first, spans[i].second );
+    applyValue( deferred[i].option, arg, deferred[i].argIndex, stats );
+  }
+}
+
+/**
+ * Runs getopt over \a argv and calls the setters of all found options,
+ * setter timings are added to \a stats if it is not null.
+ */
+int OptionSet::Private::parseArgs( const int argc, char * const *argv, ParseStats *stats )
+{
+  //setup getopt
   opterr = 0; 			// we report errors on our own
   optind = 0;                   // start on the first arg
 
+  deferred.clear();
+
+  if ( tracer )
+    tracer->record( ParseTracer::ParseBegin, nullptr, 0 );
+
   while ( true ) {
 
-    int option_index = -1;      //index of the last found long option, same as in allOpts
+    int option_index = -1;      //index of the last found long option in longopts
     int optc = getopt_long( argc, argv, shortopts.c_str(), longopts.data(), &option_index );
 
     if ( optc == -1 )
@@ -259,92 +1270,1570 @@ int parseCLI(const int argc, char * const *argv, const std::vector<CommandGroup>
 
         std::cerr << "'" << std::endl;
 
+        if ( tracer )
+          tracer->record( ParseTracer::UnknownOption, nullptr, optind - 1 );
+
         // tell the caller there have been unknown options encountered
         // result["_unknown"].push_back( "" );
         break;
       }
       case ':': {
         std::cerr << "Missing argument for " << argv[optind - 1] << std::endl;
+        if ( tracer )
+          tracer->record( ParseTracer::MissingArgument, nullptr, optind - 1 );
         // result["_missing_arg"].push_back( "" );
         break;
       }
       default: {
         int index = -1;
         if ( option_index == -1 ) {
-          //we have a short option
-          auto it = shortOptIndex.find( (char) optc );
-          if ( it != shortOptIndex.end() ) {
-            index = it->second;
-          }
+          //we have a short option, getopt returns it as a char, so bytes above 0x7f come back negative
+          index = shortOptIndex[ (unsigned char) optc ];
         } else {
           //we have a long option
-          index = option_index;
+          index = longOptIndex[ option_index ].option;
+
+          int aliasIndex = longOptIndex[ option_index ].alias;
+          if ( aliasIndex >= 0 && aliases[aliasIndex].flags & OptionAlias::Deprecated && !aliases[aliasIndex].warned ) {
+            aliases[aliasIndex].warned = true;
+            std::cerr << "Option " << aliases[aliasIndex].name << " is deprecated, use " << allOpts[index].name << " instead" << std::endl;
+          }
         }
 
         if ( index >= 0 ) {
 
+          if ( !hits.empty() )
+            hits[index]++;
+
+          if ( tracer )
+            tracer->record( ParseTracer::OptionMatched, &allOpts[index], optind - 1 );
+
+          if ( allOpts[index].flags & CommandOption::Interpolate && optarg && strstr( optarg, "${" ) ) {
+            //references are resolved after all other options are set
+            deferred.push_back( Deferred{ index, optind - 1, optarg } );
+            break;
+          }
+
           boost::optional<std::string> arg;
-          if ( optarg && strlen(optarg) ) {
+          if ( optarg && *optarg ) {
             arg = std::string(optarg);
           }
-
-          allOpts[index].value.set( &allOpts[index], arg);
+          //plain parsing calls the setter directly, the bookkeeping in applyValue is
+          //only needed with stats, a tracer, subsystems or flag files
+          if ( !stats && !tracer && supplied.empty() && !trackSources && !collecting )
+            allOpts[index].value.set( &allOpts[index], arg );
+          else
+            applyValue( index, arg, optind - 1, stats );
         }
 
         break;
       }
     }
   }
+
+  if ( !deferred.empty() )
+    applyDeferred( stats );
+
+  if ( tracer )
+    tracer->record( ParseTracer::ParseEnd, nullptr, optind );
   return optind;
 }
 
-Exception::Exception(const std::string what_r) : _what (what_r)
-{ }
+/**
+ * Parses the command line arguments based on the compiled options.
+ * \returns The first index in argv that was not parsed, or -1 if the set is not valid
+ */
+int OptionSet::parse(const int argc, char * const *argv)
+{
+  if ( !isValid() )
+    return -1;
 
-const char *Exception::what() const noexcept
+  //every parse starts with a clean state
+  for ( CommandOption &opt : d->allOpts )
+    opt.value.reset();
+
+  ParseStats *stats = nullptr;
+  if ( d->collectStats ) {
+    stats = &d->stats;
+    stats->scanNs = stats->setterNs = 0;
+    stats->options.clear();
+    for ( const CommandOption &opt : d->allOpts )
+      stats->options.push_back( ParseStats::OptionCost{ opt.name, opt.shortName, 0, 0 } );
+  }
+
+  unsigned long long parseNs = 0;
+  int res;
+  {
+    StatsTimer timer( stats ? &parseNs : nullptr );
+    res = d->parseArgs( argc, argv, stats );
+  }
+
+  if ( stats ) {
+    stats->scanNs = parseNs - stats->setterNs;
+    if ( d->statsCallback )
+      d->statsCallback( *stats );
+  }
+  return res;
+}
+
+/**
+ * Returns false if the options given to the constructor were inconsistent.
+ * This can only happen when built without exception support, otherwise
+ * the constructor throws.
+ */
+bool OptionSet::isValid() const
 {
-  return _what.c_str();
+  return d->error.empty();
 }
 
 /**
- * Renders the \a options help string
+ * Returns the reason why the set is not valid, or a empty string
  */
-void renderHelp(const std::vector<CommandGroup> &options)
+std::string OptionSet::errorString() const
 {
-  for ( const CommandGroup &grp : options ) {
-    std::cout << grp.name << ":" << std::endl << std::endl;
-    for ( const CommandOption &opt : grp.options ) {
-      if ( opt.shortName )
-        std::cout << "-" << opt.shortName << ", ";
+  return d->error;
+}
+
+/**
+ * Registers \a subsystem, it is initialized by \ref initSubsystems if one of its options was used.
+ * Subsystems have to be added before parsing, options given earlier do not count as supplied.
+ */
+void OptionSet::addSubsystem(Subsystem &&subsystem)
+{
+  d->supplied.resize( d->allOpts.size(), false );
+  d->subsystems.push_back( Private::SubsystemState{ std::move(subsystem), false } );
+}
+
+/**
+ * Runs the init callback of every subsystem that was triggered by the parsed options, and of
+ * all subsystems those depend on. Dependencies are initialized first, subsystems that do not
+ * depend on each other run concurrently if \a parallel is true. Every subsystem is initialized
+ * at most once, so calling this again after a later parse only starts the newly enabled ones.
+ * \returns false if a subsystem refers to a unknown option or subsystem or if the dependencies
+ * form a cycle, nothing is initialized in that case and the reason is written to std::cerr.
+ * This does not throw, also not when built with exception support.
+ */
+bool OptionSet::initSubsystems(bool parallel)
+{
+  const size_t count = d->subsystems.size();
+  std::vector<bool> needed( count, false );
+  std::vector<int> pending;
+  std::string current;
+
+  for ( size_t i = 0; i < count; i++ ) {
+    const Subsystem &sub = d->subsystems[i].subsystem;
+    for ( const std::string &name : sub.options ) {
+      int opt = d->findLongOption( name.c_str(), name.size() );
+      if ( opt < 0 ) {
+        std::cerr << "Subsystem: " << sub.name << " is enabled by the unknown option " << name << std::endl;
+        return false;
+      }
+
+      //without a default or a way to get the current value changed can only mean supplied
+      bool triggered = d->supplied[opt];
+      const Value &value = d->allOpts[opt].value;
+      if ( sub.trigger == Subsystem::WhenChanged && value.defaultValue() ) {
+        current.clear();
+        if ( value.appendCurrentValue( current ) )
+          triggered = !value.isDefaultValue( current );
+      }
+      if ( triggered && !needed[i] ) {
+        needed[i] = true;
+        pending.push_back( i );
+      }
+    }
+  }
+
+  //resolve the dependencies, everything a needed subsystem depends on is needed as well
+  std::vector<std::vector<int>> deps( count );
+  for ( size_t i = 0; i < count; i++ ) {
+    for ( const std::string &name : d->subsystems[i].subsystem.dependsOn ) {
+      auto it = std::find_if( d->subsystems.begin(), d->subsystems.end(), [&]( const Private::SubsystemState &state ){
+        return state.subsystem.name == name;
+      } );
+      if ( it == d->subsystems.end() ) {
+        std::cerr << "Subsystem: " << d->subsystems[i].subsystem.name << " depends on the unknown subsystem " << name << std::endl;
+        return false;
+      }
+      deps[i].push_back( it - d->subsystems.begin() );
+    }
+  }
+  while ( !pending.empty() ) {
+    int i = pending.back();
+    pending.pop_back();
+    for ( int dep : deps[i] ) {
+      if ( !needed[dep] ) {
+        needed[dep] = true;
+        pending.push_back( dep );
+      }
+    }
+  }
+
+  //sort the needed subsystems into levels, each level only depends on the ones before it
+  std::vector<std::vector<int>> levels;
+  std::vector<bool> placed( count, false );
+  size_t remaining = std::count( needed.begin(), needed.end(), true );
+  while ( remaining ) {
+    std::vector<int> level;
+    for ( size_t i = 0; i < count; i++ ) {
+      if ( !needed[i] || placed[i] )
+        continue;
+      if ( std::all_of( deps[i].begin(), deps[i].end(), [&]( int dep ){ return placed[dep]; } ) )
+        level.push_back( i );
+    }
+    if ( level.empty() ) {
+      std::cerr << "Subsystem: dependencies form a cycle" << std::endl;
+      return false;
+    }
+    for ( int i : level )
+      placed[i] = true;
+    remaining -= level.size();
+    levels.push_back( std::move( level ) );
+  }
+
+  for ( const std::vector<int> &level : levels ) {
+    std::vector<std::future<void>> running;
+    for ( int i : level ) {
+      Private::SubsystemState &state = d->subsystems[i];
+      if ( state.initialized || !state.subsystem.init )
+        continue;
+      state.initialized = true;
+      if ( parallel )
+        running.push_back( std::async( std::launch::async, state.subsystem.init ) );
       else
-        std::cout << "    ";
+        state.subsystem.init();
+    }
+    for ( std::future<void> &f : running )
+      f.get();
+  }
+  return true;
+}
 
-      std::cout << "--" << opt.name;
+namespace {
+  /**
+   * Returns true if \a name is \a scope itself or lies below it, scopes
+   * are separated by dots, so "db.pool" contains "db.pool.max-size" but not "db.poolsize".
+   */
+  bool isInScope ( const char *name, const char *scope, size_t scopeLen )
+  {
+    return strncmp( name, scope, scopeLen ) == 0 && ( name[scopeLen] == '\0' || name[scopeLen] == '.' );
+  }
+}
 
-      std::string argSyntax = opt.value.argHint();
-      if ( argSyntax.length() ) {
-        if ( opt.flags & GnuFlag::CommandOption::OptionalArgument )
-          std::cout << "[=";
-        else
-          std::cout << " <";
-        std::cout << argSyntax;
-        if ( opt.flags & GnuFlag::CommandOption::OptionalArgument )
-          std::cout << "]";
-        else
-          std::cout << ">";
+/**
+ * Returns all options whose long name is \a scope or lies below it in the dotted
+ * name hierarchy, e.g. "db.pool" returns "db.pool.max-size" and "db.pool.min-size".
+ * Options reached via a alias are returned once. The lookup uses the sorted name table,
+ * so only the names sharing the prefix are looked at.
+ */
+std::vector<const CommandOption *> OptionSet::scope(const std::string &scope) const
+{
+  std::vector<const CommandOption *> res;
+
+  auto it = std::lower_bound( d->sortedNames.begin(), d->sortedNames.end(), scope.c_str(), []( const Private::NameRef &ref, const char *name ){
+    return strcmp( ref.name, name ) < 0;
+  } );
+
+  for ( ; it != d->sortedNames.end() && strncmp( it->name, scope.c_str(), scope.size() ) == 0; ++it ) {
+    if ( !isInScope( it->name, scope.c_str(), scope.size() ) )
+      continue;
+
+    const CommandOption *opt = &d->allOpts[it->option];
+    if ( std::find( res.begin(), res.end(), opt ) == res.end() )
+      res.push_back( opt );
+  }
+  return res;
+}
+
+namespace {
+  /**
+   * Identifies the option layout a snapshot was taken from
+   */
+  uint64_t optionFingerprint ( const std::vector<CommandOption> &opts )
+  {
+    uint64_t hash = fnv1a( nullptr, 0 );
+    for ( const CommandOption &opt : opts ) {
+      if ( opt.name )
+        hash = fnv1a( opt.name, strlen( opt.name ) + 1, hash );
+      hash = fnv1a( &opt.shortName, 1, hash );
+      hash = fnv1a( reinterpret_cast<const char *>( &opt.flags ), sizeof(opt.flags), hash );
+    }
+    return hash;
+  }
+
+  const char *restoreOptionStates ( std::vector<CommandOption> &opts, const char *pos, const char *end )
+  {
+    for ( CommandOption &opt : opts ) {
+      pos = opt.value.restoreState( pos, end );
+      if ( !pos )
+        break;
+    }
+    return pos;
+  }
+}
+
+/**
+ * Captures the current value of all option targets into a compact buffer,
+ * that can be passed to \ref restore later. Values without save and restore
+ * functions, like \sa RegexType, are not captured.
+ */
+std::string OptionSet::snapshot() const
+{
+  std::string buf;
+  saveRaw( buf, optionFingerprint( d->allOpts ) );
+  for ( const CommandOption &opt : d->allOpts )
+    opt.value.saveState( buf );
+  return buf;
+}
+
+/**
+ * Writes the values captured by \ref snapshot back into all option targets.
+ * Snapshots of a OptionSet with different options and truncated or otherwise
+ * damaged snapshots are rejected, the targets keep their values in that case.
+ * \returns true if the snapshot was applied
+ */
+bool OptionSet::restore(const std::string &snapshot)
+{
+  const char *end = snapshot.data() + snapshot.size();
+  uint64_t fingerprint = 0;
+  const char *pos = restoreRaw( snapshot.data(), end, fingerprint );
+  if ( !pos || fingerprint != optionFingerprint( d->allOpts ) )
+    return false;
+
+  //a damaged snapshot is only noticed halfway through, so keep a way back
+  std::string backup = this->snapshot();
+  if ( restoreOptionStates( d->allOpts, pos, end ) != end ) {
+    restoreOptionStates( d->allOpts, backup.data() + sizeof(fingerprint), backup.data() + backup.size() );
+    return false;
+  }
+  return true;
+}
+
+namespace {
+  /**
+   * Splits the flag file lines between \a begin and \a end into arguments, see \ref readFlagFile
+   */
+  void tokenizeFlagLines ( const char *begin, const char *end, std::vector<std::string> &args, std::vector<size_t> *lineStarts )
+  {
+    auto isBlank = []( char c ){ return c == ' ' || c == '\t' || c == '\r'; };
+
+    for ( const char *pos = begin; pos < end; ) {
+      const char *eol = static_cast<const char *>( memchr( pos, '\n', end - pos ) );
+      if ( !eol )
+        eol = end;
+
+      const char *first = pos;
+      const char *last  = eol;
+      while ( first < last && isBlank( *first ) )
+        first++;
+      while ( last > first && isBlank( last[-1] ) )
+        last--;
+
+      if ( first < last && *first != '#' ) {
+        std::string line( first, last );
+        if ( line[0] != '-' )
+          line.insert( 0, "--" );
+
+        if ( lineStarts )
+          lineStarts->push_back( args.size() );
+
+        //every line becomes one argument, getopt never gives a separate argument to a option
+        //with a optional value: "--name value" turns into "--name=value", "-n value" into "-nvalue"
+        size_t space = line.find_first_of( " \t" );
+        if ( space != std::string::npos && space < line.find( '=' ) ) {
+          size_t value = line.find_first_not_of( " \t", space );
+          line.replace( space, value - space, line[1] == '-' ? "=" : "" );
+        }
+        args.push_back( std::move( line ) );
       }
+      pos = eol + 1;
+    }
+  }
 
-      std::cout << "\t" << opt.help;
+  /**
+   * Reads a flag file into \a args. Every non empty line that does not start with '#'
+   * holds one option as "--name=value", "--name value" or "-n value", the leading
+   * dashes can be left out for long options, so "name=value" works as well.
+   * Each line yields exactly one argument, a value separated by blanks is joined to the option.
+   * If \a lineStarts is given the index in \a args where each line starts is appended to it.
+   *
+   * Big files are cut into chunks at line boundaries that are tokenized concurrently and
+   * joined in file order, so no argument ever crosses a chunk and the result is the same
+   * as tokenizing the file in one go.
+   */
+  bool readFlagFile ( const std::string &file, std::vector<std::string> &args, std::vector<size_t> *lineStarts = nullptr )
+  {
+    std::ifstream in( file, std::ios::binary );
+    if ( !in )
+      return false;
 
-      auto defVal = opt.value.defaultValue();
-      if ( defVal )
-        std::cout << " Default: " << *defVal;
+    std::string content( ( std::istreambuf_iterator<char>( in ) ), std::istreambuf_iterator<char>() );
+    if ( in.bad() )
+      return false;
 
-      std::cout << std::endl;
+    const char *data = content.data();
+    const char *end  = data + content.size();
+
+    //below a few MiB starting threads costs more than it saves
+    const size_t minChunkSize = 1 << 20;
+    size_t chunks = std::min<size_t>( std::thread::hardware_concurrency(), content.size() / minChunkSize );
+    if ( chunks < 2 ) {
+      tokenizeFlagLines( data, end, args, lineStarts );
+      return true;
+    }
 
+    std::vector<const char *> cuts{ data };
+    for ( size_t i = 1; i < chunks; i++ ) {
+      const char *cut = data + content.size() / chunks * i;
+      if ( cut < cuts.back() )
+        continue;
+      cut = static_cast<const char *>( memchr( cut, '\n', end - cut ) );
+      if ( !cut )
+        break;
+      cuts.push_back( cut + 1 );
     }
-    std::cout<<std::endl;
+    cuts.push_back( end );
+
+    struct Chunk
+    {
+      std::vector<std::string> args;
+      std::vector<size_t> lineStarts;
+    };
+    std::vector<std::future<Chunk>> running;
+    for ( size_t i = 0; i + 1 < cuts.size(); i++ ) {
+      running.push_back( std::async( std::launch::async, [&cuts, i, lineStarts]() {
+        Chunk chunk;
+        tokenizeFlagLines( cuts[i], cuts[i + 1], chunk.args, lineStarts ? &chunk.lineStarts : nullptr );
+        return chunk;
+      } ) );
+    }
+
+    for ( std::future<Chunk> &f : running ) {
+      Chunk chunk = f.get();
+      if ( lineStarts ) {
+        for ( size_t start : chunk.lineStarts )
+          lineStarts->push_back( args.size() + start );
+      }
+      if ( args.empty() ) {
+        args.swap( chunk.args );
+      } else {
+        args.insert( args.end(), std::make_move_iterator( chunk.args.begin() ), std::make_move_iterator( chunk.args.end() ) );
+      }
+    }
+    return true;
+  }
+}
+
+/**
+ * Loads the flag files in \a files, see \ref readFlagFile for the format.
+ * All files are read and tokenized concurrently, afterwards they are applied
+ * one by one in the given order on the calling thread, so later files override
+ * earlier ones and the result is the same as loading them one after the other.
+ * A line that is not a option is reported and skipped, the rest of the file is still applied.
+ * \returns false if a file could not be read or contained something that is not a option
+ */
+bool OptionSet::loadFlagFiles(const std::vector<std::string> &files)
+{
+  std::vector<std::future<std::pair<bool, std::vector<std::string>>>> sources;
+  sources.reserve( files.size() );
+  for ( const std::string &file : files ) {
+    sources.push_back( std::async( std::launch::async, [&file]() {
+      std::vector<std::string> args;
+      bool ok = readFlagFile( file, args );
+      return std::make_pair( ok, std::move( args ) );
+    } ) );
   }
+
+  bool ok = true;
+  for ( size_t i = 0; i < sources.size(); i++ ) {
+    std::pair<bool, std::vector<std::string>> source = sources[i].get();
+    if ( !source.first ) {
+      std::cerr << "Unable to read flag file " << files[i] << std::endl;
+      ok = false;
+      continue;
+    }
+
+    std::vector<char *> argv;
+    argv.reserve( source.second.size() + 2 );
+    argv.push_back( const_cast<char *>( files[i].c_str() ) );
+    for ( std::string &arg : source.second )
+      argv.push_back( &arg[0] );
+    argv.push_back( nullptr );
+
+    int argc = argv.size() - 1;
+    //recorded as a invocation of its own, so a replay parses the file content as well
+    captureInvocation( *this, argc, argv.data(), std::vector<std::string>{ files[i] } );
+
+    d->startSourceTracking();
+    d->currentSource = d->sourceIndex( files[i] );
+    d->contributions.push_back( Private::Contribution{ -1, d->currentSource, boost::none } );
+
+    //a bad line is reported and skipped, the lines after it are still applied. parse
+    //takes the first argument as program name, so restarting at the bad one skips it
+    for ( int start = 0; ; ) {
+      int next = parse( argc - start, argv.data() + start );
+      if ( next < 0 ) {
+        ok = false;
+        break;
+      }
+      if ( start + next >= argc )
+        break;
+      std::cerr << "Unexpected " << argv[start + next] << " in flag file " << files[i] << std::endl;
+      ok = false;
+      start += next;
+    }
+    d->currentSource = -1;
+  }
+  return ok;
+}
+
+/**
+ * Enables or disables counting how often each option is used in \ref parse.
+ * Disabling it drops all counts recorded so far.
+ */
+void OptionSet::setRecordHits( bool enable )
+{
+  if ( enable )
+    d->hits.resize( d->allOpts.size(), 0 );
+  else
+    d->hits.clear();
+}
+
+/**
+ * Enables or disables collecting \sa ParseStats in \ref parse. If given, \a callback
+ * is called with the results after every parse.
+ */
+void OptionSet::setCollectStats( bool enable, StatsCallback &&callback )
+{
+  d->collectStats = enable;
+  d->statsCallback = std::move( callback );
+}
+
+/**
+ * Returns the statistics of the last parse, the build time
+ * of the lookup tables is always available.
+ */
+const ParseStats &OptionSet::stats() const
+{
+  return d->stats;
+}
+
+/**
+ * Records the events of every following \ref parse into \a tracer,
+ * pass nullptr to stop tracing. The tracer is not owned by the OptionSet.
+ */
+void OptionSet::setTracer( ParseTracer *tracer )
+{
+  d->tracer = tracer;
+}
+
+namespace {
+  std::string profileKey ( const CommandOption &opt )
+  {
+    if ( opt.name )
+      return opt.name;
+    return std::string("-") + opt.shortName;
+  }
+}
+
+/**
+ * Writes the recorded hit counts to \a file, one "count name" pair per line.
+ * Options without a long name are written as "-c".
+ * \returns false if the file could not be written
+ */
+bool OptionSet::saveProfile( const std::string &file ) const
+{
+  std::ofstream out( file );
+  if ( !out )
+    return false;
+
+  for ( size_t i = 0; i < d->allOpts.size(); i++ ) {
+    unsigned long count = d->hits.empty() ? 0 : d->hits[i];
+    out << count << " " << profileKey( d->allOpts[i] ) << "\n";
+  }
+  return out.good();
+}
+
+/**
+ * Reads a profile written by \ref saveProfile and reorders the lookup tables
+ * so the most frequently used options are found first. Unknown names in the
+ * profile are ignored, options missing from it keep their relative order behind the known ones.
+ * getopt resolves a abbreviated long option to the first match in its table, so options whose
+ * names start with the same character keep their declaration order among each other and
+ * a profile never changes what a abbreviation means.
+ * If recording is enabled the loaded counts are used as the starting point.
+ * \returns false if the file could not be read
+ */
+bool OptionSet::loadProfile( const std::string &file )
+{
+  std::ifstream in( file );
+  if ( !in )
+    return false;
+
+  std::map<std::string, size_t> keys;
+  for ( size_t i = 0; i < d->allOpts.size(); i++ )
+    keys.emplace( profileKey( d->allOpts[i] ), i );
+
+  std::vector<unsigned long> counts( d->allOpts.size(), 0 );
+  unsigned long count;
+  std::string key;
+  while ( in >> count >> key ) {
+    auto it = keys.find( key );
+    if ( it != keys.end() )
+      counts[it->second] = count;
+  }
+
+  std::vector<int> order( d->allOpts.size() );
+  for ( size_t i = 0; i < order.size(); i++ )
+    order[i] = i;
+  std::stable_sort( order.begin(), order.end(), [&counts]( int a, int b ){ return counts[a] > counts[b]; } );
+
+  //only options with the same first character can match the same abbreviation, within each
+  //such class the hottest positions are handed out again in declaration order
+  std::vector<std::vector<size_t>> slots( 256 );
+  for ( size_t pos = 0; pos < order.size(); pos++ ) {
+    const char *name = d->allOpts[order[pos]].name;
+    if ( name )
+      slots[ (unsigned char) name[0] ].push_back( pos );
+  }
+  std::vector<int> members;
+  for ( const std::vector<size_t> &positions : slots ) {
+    members.clear();
+    for ( size_t pos : positions )
+      members.push_back( order[pos] );
+    std::sort( members.begin(), members.end() );
+    for ( size_t i = 0; i < positions.size(); i++ )
+      order[positions[i]] = members[i];
+  }
+  d->buildLookupTables( order );
+
+  if ( !d->hits.empty() )
+    d->hits = counts;
+  return true;
+}
+
+/**
+ * Parses the command line arguments based on \a options.
+ * Use a \sa OptionSet directly if the same options are parsed more than once.
+ * \returns The first index in argv that was not parsed, or -1 if the options are inconsistent
+ * and exceptions are disabled
+ */
+int parseCLI(const int argc, char * const *argv, const std::vector<CommandGroup> &options)
+{
+  OptionSet set( options );
+  captureInvocation( set, argc, argv );
+  return set.parse( argc, argv );
+}
+
+/**
+ * Replaces the values of all \a Secret options in \a args, which is laid out like argv, by "***".
+ * The arguments are walked the way getopt does it: scanning stops at "--" or the first
+ * non option, a option with a required argument consumes the next argument if it has no
+ * inline value. Abbreviated long options are redacted if any option they can stand for is secret.
+ */
+void OptionSet::Private::redactSecrets( std::vector<std::string> &args ) const
+{
+  for ( size_t i = 1; i < args.size(); i++ ) {
+    std::string &arg = args[i];
+    if ( arg.size() < 2 || arg[0] != '-' || arg == "--" )
+      break;
+
+    if ( arg[1] == '-' ) {
+      size_t eq = arg.find( '=' );
+      const char *name = arg.c_str() + 2;
+      size_t len = std::min( eq, arg.size() ) - 2;
+
+      bool secret = false;
+      bool required = false;
+      auto check = [&]( int index ) {
+        secret = secret || ( allOpts[index].flags & CommandOption::Secret );
+        required = required || ( allOpts[index].flags & CommandOption::ArgumentTypeMask ) == CommandOption::RequiredArgument;
+      };
+      int exact = findLongOption( name, len );
+      if ( exact >= 0 ) {
+        check( exact );
+      } else {
+        auto it = std::lower_bound( sortedNames.begin(), sortedNames.end(), std::make_pair( name, len ), []( const NameRef &ref, const std::pair<const char *, size_t> &key ){
+          return strncmp( ref.name, key.first, key.second ) < 0;
+        } );
+        for ( ; it != sortedNames.end() && strncmp( it->name, name, len ) == 0; ++it )
+          check( it->option );
+      }
+
+      if ( eq != std::string::npos ) {
+        if ( secret )
+          arg.replace( eq + 1, std::string::npos, "***" );
+      } else if ( required && i + 1 < args.size() ) {
+        if ( secret )
+          args[i + 1] = "***";
+        i++;
+      }
+      continue;
+    }
+
+    //a bundle of short options, the first one taking a argument ends it
+    for ( size_t c = 1; c < arg.size(); c++ ) {
+      int index = shortOptIndex[ (unsigned char) arg[c] ];
+      if ( index < 0 )
+        continue;
+      int type = allOpts[index].flags & CommandOption::ArgumentTypeMask;
+      if ( type == CommandOption::NoArgument )
+        continue;
+      bool secret = allOpts[index].flags & CommandOption::Secret;
+      if ( c + 1 < arg.size() ) {
+        if ( secret )
+          arg.replace( c + 1, std::string::npos, "***" );
+      } else if ( type == CommandOption::RequiredArgument && i + 1 < args.size() ) {
+        if ( secret )
+          args[i + 1] = "***";
+        i++;
+      }
+      break;
+    }
+  }
+}
+
+namespace {
+  const char captureMagic[4] = { 'G', 'F', 'C', '1' };
+
+  /**
+   * Returns the 64 bit FNV-1a hash of the content of \a file, or 0 if it can not be read
+   */
+  uint64_t hashFile ( const std::string &file )
+  {
+    std::ifstream in( file, std::ios::binary );
+    if ( !in )
+      return 0;
+
+    uint64_t hash = fnv1a( nullptr, 0 );
+    char buf[65536];
+    while ( in.read( buf, sizeof(buf) ) || in.gcount() )
+      hash = fnv1a( buf, in.gcount(), hash );
+    return hash;
+  }
+}
+
+namespace {
+  /**
+   * Appends one record with \a args, the environment listed in GNUFLAG_CAPTURE_ENV and the hashes
+   * of \a flagFiles to \a logFile, see \ref captureInvocation
+   */
+  void writeCapture ( const char *logFile, const std::vector<std::string> &args, const std::vector<std::string> &flagFiles )
+  {
+    std::string record( captureMagic, sizeof(captureMagic) );
+    saveRaw( record, uint32_t(0) ); //payload size, filled in below
+
+    saveRaw( record, uint32_t( args.size() ) );
+    for ( const std::string &arg : args )
+      saveStringState( record, arg );
+
+    std::vector<std::pair<std::string, std::string>> env;
+    if ( const char *names = getenv( "GNUFLAG_CAPTURE_ENV" ) ) {
+      while ( *names ) {
+        const char *sep = strchr( names, ',' );
+        std::string name( names, sep ? sep - names : strlen( names ) );
+        if ( const char *value = name.empty() ? nullptr : getenv( name.c_str() ) )
+          env.emplace_back( std::move( name ), value );
+        if ( !sep )
+          break;
+        names = sep + 1;
+      }
+    }
+    saveRaw( record, uint32_t( env.size() ) );
+    for ( const auto &var : env ) {
+      saveStringState( record, var.first );
+      saveStringState( record, var.second );
+    }
+
+    saveRaw( record, uint32_t( flagFiles.size() ) );
+    for ( const std::string &file : flagFiles ) {
+      saveStringState( record, file );
+      saveRaw( record, hashFile( file ) );
+    }
+
+    uint32_t payload = record.size() - sizeof(captureMagic) - sizeof(uint32_t);
+    memcpy( &record[sizeof(captureMagic)], &payload, sizeof(payload) );
+
+    int fd = open( logFile, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644 );
+    if ( fd < 0 )
+      return;
+    if ( write( fd, record.data(), record.size() ) != ssize_t( record.size() ) )
+      std::cerr << "Unable to write to capture log " << logFile << std::endl;
+    close( fd );
+  }
+
+  /**
+   * Returns the capture log named by GNUFLAG_CAPTURE, or nullptr if capturing is off
+   */
+  const char *captureLog ( )
+  {
+    static const char *logFile = getenv( "GNUFLAG_CAPTURE" );
+    return logFile && *logFile ? logFile : nullptr;
+  }
+}
+
+/**
+ * Appends \a argc and \a argv to the capture log if the GNUFLAG_CAPTURE environment variable
+ * names one, otherwise this does nothing. Environment variables listed comma separated in
+ * GNUFLAG_CAPTURE_ENV are recorded along with the arguments, of \a flagFiles only a hash of
+ * the content is kept so a replay can tell if the files changed in the meantime.
+ *
+ * This overload does not know the options, so the arguments are written as they are.
+ * Use the one taking a \sa OptionSet if any option is \a Secret.
+ *
+ * Every invocation is written as one record with a single append, so processes sharing a log
+ * do not interleave. The records use the native byte order and are read by \ref readCapture.
+ */
+void captureInvocation(const int argc, char * const *argv, const std::vector<std::string> &flagFiles)
+{
+  const char *logFile = captureLog();
+  if ( !logFile )
+    return;
+  writeCapture( logFile, std::vector<std::string>( argv, argv + argc ), flagFiles );
+}
+
+/**
+ * Like the overload above, but the values of options in \a options flagged as \a Secret are
+ * replaced by "***" before anything is written.
+ * \ref parseCLI calls this on its own and \ref OptionSet::loadFlagFiles records every file it
+ * loads, users of \sa OptionSet call it before parsing argv.
+ */
+void captureInvocation(const OptionSet &options, const int argc, char * const *argv, const std::vector<std::string> &flagFiles)
+{
+  const char *logFile = captureLog();
+  if ( !logFile )
+    return;
+  std::vector<std::string> args( argv, argv + argc );
+  options.d->redactSecrets( args );
+  writeCapture( logFile, args, flagFiles );
+}
+
+/**
+ * Reads all invocations recorded by \ref captureInvocation in \a file and appends them to \a out.
+ * A truncated last record, e.g. from a process that was killed while writing, is ignored.
+ * \returns false if the file can not be read or is not a capture log
+ */
+bool readCapture(const std::string &file, std::vector<CapturedInvocation> &out)
+{
+  std::ifstream in( file, std::ios::binary );
+  if ( !in )
+    return false;
+
+  std::string content( ( std::istreambuf_iterator<char>( in ) ), std::istreambuf_iterator<char>() );
+  if ( in.bad() )
+    return false;
+
+  const char *pos = content.data();
+  const char *end = pos + content.size();
+
+  while ( size_t( end - pos ) >= sizeof(captureMagic) + sizeof(uint32_t) ) {
+    if ( memcmp( pos, captureMagic, sizeof(captureMagic) ) != 0 )
+      return false;
+    pos += sizeof(captureMagic);
+
+    uint32_t payload = 0;
+    pos = restoreRaw( pos, end, payload );
+    if ( size_t( end - pos ) < payload )
+      break;
+    const char *next = pos + payload;
+
+    //every read is checked, the log comes from outside
+    CapturedInvocation inv;
+    uint32_t count = 0;
+    pos = restoreRaw( pos, next, count );
+    for ( uint32_t i = 0; pos && i < count; i++ ) {
+      inv.args.emplace_back();
+      pos = restoreStringState( pos, next, inv.args.back() );
+    }
+    pos = restoreRaw( pos, next, count );
+    for ( uint32_t i = 0; pos && i < count; i++ ) {
+      inv.env.emplace_back();
+      pos = restoreStringState( pos, next, inv.env.back().first );
+      pos = restoreStringState( pos, next, inv.env.back().second );
+    }
+    pos = restoreRaw( pos, next, count );
+    for ( uint32_t i = 0; pos && i < count; i++ ) {
+      inv.flagFiles.emplace_back();
+      pos = restoreStringState( pos, next, inv.flagFiles.back().first );
+      pos = restoreRaw( pos, next, inv.flagFiles.back().second );
+    }
+    if ( pos != next )
+      return false;
+
+    out.push_back( std::move( inv ) );
+  }
+  return true;
+}
+
+/**
+ * Feeds every invocation in \a corpus \a rounds times through \a options and measures how long
+ * each parse takes. The "parseCLI" engine builds the option tables for every invocation like
+ * \ref parseCLI does, "OptionSet" compiles them once and only parses.
+ *
+ * Every invocation starts from the original state: environment variables recorded anywhere in
+ * the corpus are reset before the recorded ones are set, and the variables bound to \a options
+ * are restored from a \ref OptionSet::snapshot taken up front. Both are put back at the end,
+ * values that can not save their state keep what the last invocation wrote. Flag files are not
+ * loaded since only their hashes are captured, their content is replayed through the records
+ * \ref OptionSet::loadFlagFiles writes. Diagnostics for unknown options go to std::cerr as usual.
+ */
+ReplayStats replayCapture(const std::vector<CapturedInvocation> &corpus, const std::vector<CommandGroup> &options, int rounds)
+{
+  //argv has to be writable, so work on a copy
+  std::vector<std::vector<std::string>> args;
+  std::vector<std::vector<char *>> argvs;
+  args.reserve( corpus.size() );
+  argvs.reserve( corpus.size() );
+  std::vector<std::pair<std::string, boost::optional<std::string>>> savedEnv;
+  for ( const CapturedInvocation &inv : corpus ) {
+    args.push_back( inv.args );
+    argvs.emplace_back();
+    for ( std::string &arg : args.back() )
+      argvs.back().push_back( &arg[0] );
+    argvs.back().push_back( nullptr );
+
+    for ( const auto &var : inv.env ) {
+      if ( std::none_of( savedEnv.begin(), savedEnv.end(), [&]( const std::pair<std::string, boost::optional<std::string>> &saved ){ return saved.first == var.first; } ) ) {
+        const char *value = getenv( var.first.c_str() );
+        savedEnv.emplace_back( var.first, value ? boost::optional<std::string>( value ) : boost::optional<std::string>() );
+      }
+    }
+  }
+
+  auto restoreEnv = [&savedEnv]() {
+    for ( const auto &saved : savedEnv ) {
+      if ( saved.second )
+        setenv( saved.first.c_str(), saved.second->c_str(), 1 );
+      else
+        unsetenv( saved.first.c_str() );
+    }
+  };
+
+  ReplayStats res;
+  std::vector<unsigned long long> times;
+  times.reserve( corpus.size() * std::max( rounds, 0 ) );
+  OptionSet compiled( options );
+  //the replay writes into the programs variables, they get their values back in the end
+  //and every invocation starts from them, so accumulating targets do not keep growing
+  const std::string initial = compiled.snapshot();
+
+  for ( bool rebuild : { true, false } ) {
+    times.clear();
+    unsigned long long totalNs = 0;
+    for ( int round = 0; round < rounds; round++ ) {
+      for ( size_t i = 0; i < corpus.size(); i++ ) {
+        //start from the original environment and values, so nothing of the previous invocation leaks
+        restoreEnv();
+        compiled.restore( initial );
+        for ( const auto &var : corpus[i].env )
+          setenv( var.first.c_str(), var.second.c_str(), 1 );
+
+        //timed directly, StatsTimer is compiled out with GNUFLAG_NO_STATS
+        auto start = std::chrono::steady_clock::now();
+        //not parseCLI itself, a replay must not end up in the capture log again
+        if ( rebuild )
+          OptionSet( options ).parse( argvs[i].size() - 1, argvs[i].data() );
+        else
+          compiled.parse( argvs[i].size() - 1, argvs[i].data() );
+        unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count();
+        times.push_back( ns );
+        totalNs += ns;
+      }
+    }
+
+    ReplayStats::Engine stats{ rebuild ? "parseCLI" : "OptionSet", static_cast<unsigned long>( times.size() ), 0, 0, 0, 0, 0 };
+    if ( !times.empty() ) {
+      std::sort( times.begin(), times.end() );
+      auto percentile = [&times]( size_t p ) { return times[ ( times.size() - 1 ) * p / 100 ]; };
+      stats.p50Ns = percentile( 50 );
+      stats.p90Ns = percentile( 90 );
+      stats.p99Ns = percentile( 99 );
+      stats.maxNs = times.back();
+      if ( totalNs )
+        stats.invocationsPerSecond = times.size() * 1e9 / totalNs;
+    }
+    res.engines.push_back( stats );
+  }
+
+  restoreEnv();
+  compiled.restore( initial );
+  return res;
+}
+
+/**
+ * @class ParseTracer
+ * Collects timestamped events while a \sa OptionSet parses the arguments.
+ * The buffer is allocated once, recording an event never allocates.
+ */
+ParseTracer::ParseTracer( size_t capacity )
+  : _events( capacity ? capacity : 1 )
+{ }
+
+/**
+ * Appends a event of \a type for \a opt, which can be nullptr if the event
+ * does not belong to a option.
+ */
+void ParseTracer::record( EventType type, const CommandOption *opt, int argIndex )
+{
+  Event &ev = _events[_next];
+  ev.type = type;
+  ev.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+  ev.name = opt ? opt->name : nullptr;
+  ev.shortName = opt ? opt->shortName : 0;
+  ev.argIndex = argIndex;
+
+  if ( ++_next == _events.size() ) {
+    _next = 0;
+    _wrapped = true;
+  }
+}
+
+/**
+ * Drops all recorded events
+ */
+void ParseTracer::clear()
+{
+  _next = 0;
+  _wrapped = false;
+}
+
+/**
+ * Returns the recorded events, oldest first
+ */
+std::vector<ParseTracer::Event> ParseTracer::events() const
+{
+  std::vector<Event> res;
+  if ( _wrapped ) {
+    res.reserve( _events.size() );
+    res.insert( res.end(), _events.begin() + _next, _events.end() );
+  }
+  res.insert( res.end(), _events.begin(), _events.begin() + _next );
+  return res;
+}
+
+/**
+ * Returns the recorded events in the Chrome trace event JSON format,
+ * which can be loaded into chrome://tracing or Perfetto.
+ */
+std::string ParseTracer::toChromeTrace() const
+{
+  std::string res = "{\"traceEvents\":[";
+  bool first = true;
+
+  for ( const Event &ev : events() ) {
+    const char *name = "";
+    const char *phase = "i";
+    switch ( ev.type ) {
+      case ParseBegin:      name = "parse";            phase = "B"; break;
+      case ParseEnd:        name = "parse";            phase = "E"; break;
+      case OptionMatched:   name = "match";            break;
+      case SetterBegin:     name = "setter";           phase = "B"; break;
+      case SetterEnd:       name = "setter";           phase = "E"; break;
+      case UnknownOption:   name = "unknown option";   break;
+      case MissingArgument: name = "missing argument"; break;
+    }
+
+    if ( !first )
+      res += ",";
+    first = false;
+
+    res += "{\"name\":\"";
+    res += name;
+    res += "\",\"ph\":\"";
+    res += phase;
+    res += "\",\"ts\":";
+    res += std::to_string( ev.timestampNs / 1000 );
+    res += ".";
+    std::string frac = std::to_string( ev.timestampNs % 1000 );
+    res.append( 3 - frac.size(), '0' );
+    res += frac;
+    res += ",\"pid\":0,\"tid\":0";
+    if ( *phase == 'i' )
+      res += ",\"s\":\"t\"";
+    res += ",\"args\":{\"argv\":";
+    res += std::to_string( ev.argIndex );
+    if ( ev.name ) {
+      //option names are identifiers, they need no escaping
+      res += ",\"option\":\"";
+      res += ev.name;
+      res += "\"";
+    } else if ( ev.shortName ) {
+      res += ",\"option\":\"";
+      res += ev.shortName;
+      res += "\"";
+    }
+    res += "}}";
+  }
+
+  res += "]}";
+  return res;
+}
+
+/**
+ * @class FlagFileWatcher
+ * Watches flag files with inotify and re-applies them to a \sa OptionSet when they change.
+ * Only the options whose lines were added, modified or removed since the last time are
+ * passed to the setters again, so a one line edit costs one setter call no matter how big
+ * the file is. The directories of the files are watched instead of the files themselves,
+ * so editors that replace a file by renaming a new one over it are noticed as well.
+ */
+struct FlagFileWatcher::Private
+{
+  struct Entry
+  {
+    std::string key;      //option name and how often it was seen before in the file
+    int option;           //index in the options allOpts, -1 if unknown
+    std::string content;  //arguments of the line, each terminated by '\0'
+  };
+
+  struct File
+  {
+    std::string path;
+    std::string dir;
+    std::string name;
+    int wd;
+    std::vector<Entry> applied; //in line order
+  };
+
+  OptionSet &options;
+  int debounceMs;
+  int fd = -1;
+  std::vector<File> files;
+
+  Private( OptionSet &options_r, int debounceMs_r ) : options( options_r ), debounceMs( debounceMs_r ) { }
+
+  int findOption ( const std::string &arg ) const;
+  bool readEntries ( const std::string &path, std::vector<Entry> &entries ) const;
+  void readEvents ( std::vector<bool> &changed );
+  int reapply ( const std::vector<bool> &changed );
+};
+
+namespace {
+  void appendEntryArgs ( const std::string &content, std::vector<std::string> &args )
+  {
+    for ( size_t pos = 0; pos < content.size(); ) {
+      size_t end = content.find( '\0', pos );
+      args.push_back( content.substr( pos, end - pos ) );
+      pos = end + 1;
+    }
+  }
+}
+
+/**
+ * Returns the index of the option named by the flag file argument \a arg, or -1.
+ * Abbreviated long names are not resolved, their lines are handled like unknown ones.
+ */
+int FlagFileWatcher::Private::findOption( const std::string &arg ) const
+{
+  const OptionSet::Private &set = *options.d;
+  if ( arg.compare( 0, 2, "--" ) == 0 )
+    return set.findLongOption( arg.c_str() + 2, std::min( arg.find( '=' ), arg.size() ) - 2 );
+  if ( arg.size() >= 2 && arg[0] == '-' )
+    return set.shortOptIndex[ (unsigned char) arg[1] ];
+  return -1;
+}
+
+/**
+ * Reads \a path and splits it into one entry per line. Lines are keyed by their option name
+ * and the how many times that option was seen before, so repeated options stay apart.
+ */
+bool FlagFileWatcher::Private::readEntries( const std::string &path, std::vector<Entry> &entries ) const
+{
+  std::vector<std::string> args;
+  std::vector<size_t> lineStarts;
+  if ( !readFlagFile( path, args, &lineStarts ) )
+    return false;
+
+  std::map<std::string, int> seen;
+  for ( size_t l = 0; l < lineStarts.size(); l++ ) {
+    size_t begin = lineStarts[l];
+    size_t end = l + 1 < lineStarts.size() ? lineStarts[l + 1] : args.size();
+
+    Entry entry;
+    const std::string &arg = args[begin];
+    entry.key = arg.compare( 0, 2, "--" ) == 0 ? arg.substr( 0, arg.find( '=' ) ) : arg.substr( 0, 2 );
+    entry.option = findOption( entry.key );
+    entry.key += '#';
+    entry.key += std::to_string( seen[entry.key]++ );
+
+    for ( size_t a = begin; a < end; a++ ) {
+      entry.content += args[a];
+      entry.content += '\0';
+    }
+    entries.push_back( std::move( entry ) );
+  }
+  return true;
+}
+
+/**
+ * Reads all pending inotify events and marks the watched files they refer to in \a changed
+ */
+void FlagFileWatcher::Private::readEvents( std::vector<bool> &changed )
+{
+  alignas(struct inotify_event) char buf[4096];
+  while ( true ) {
+    ssize_t len = read( fd, buf, sizeof(buf) );
+    if ( len <= 0 )
+      return;
+
+    for ( char *ptr = buf; ptr < buf + len; ) {
+      const struct inotify_event *ev = reinterpret_cast<const struct inotify_event *>( ptr );
+      for ( size_t i = 0; i < files.size(); i++ ) {
+        if ( files[i].wd == ev->wd && ev->len && files[i].name == ev->name )
+          changed[i] = true;
+      }
+      ptr += sizeof(struct inotify_event) + ev->len;
+    }
+  }
+}
+
+/**
+ * Re-reads the files marked in \a changed and applies the options whose lines differ.
+ * A single changed line can not be applied on its own if the option collects all its
+ * occurrences, like \sa StringContainerType, or is \a Repeatable: the values such options
+ * got from the changed files are replaced in the log the \sa OptionSet keeps of them, and
+ * the options are rebuilt from it, so values from the command line or other files stay.
+ * Of all other options the last line over all files is applied, just like
+ * \ref OptionSet::loadFlagFiles does.
+ * \returns the number of added, modified or removed lines
+ */
+int FlagFileWatcher::Private::reapply( const std::vector<bool> &changed )
+{
+  std::vector<std::string> args;
+  std::vector<int> touched;  //known options with changed lines
+  int changedLines = 0;
+
+  for ( size_t f = 0; f < files.size(); f++ ) {
+    if ( !changed[f] )
+      continue;
+
+    std::vector<Entry> entries;
+    if ( !readEntries( files[f].path, entries ) )
+      continue;  //probably in the middle of being replaced, the next event brings it back
+
+    std::map<std::string, const Entry *> old;
+    for ( const Entry &entry : files[f].applied )
+      old.emplace( entry.key, &entry );
+
+    for ( const Entry &entry : entries ) {
+      auto it = old.find( entry.key );
+      if ( it != old.end() ) {
+        bool same = it->second->content == entry.content;
+        old.erase( it );
+        if ( same )
+          continue;
+      }
+      changedLines++;
+      if ( entry.option >= 0 )
+        touched.push_back( entry.option );
+      else
+        appendEntryArgs( entry.content, args );  //let parse report it
+    }
+
+    //what is left was removed, accumulating options lose those values below
+    for ( const auto &removed : old ) {
+      changedLines++;
+      if ( removed.second->option >= 0 )
+        touched.push_back( removed.second->option );
+    }
+    files[f].applied.swap( entries );
+  }
+
+  std::sort( touched.begin(), touched.end() );
+  touched.erase( std::unique( touched.begin(), touched.end() ), touched.end() );
+
+  OptionSet::Private &set = *options.d;
+  bool rebuild = false;
+  for ( int option : touched )
+    rebuild = rebuild || set.accumulates( option );
+
+  if ( rebuild ) {
+    //all values the changed files give to accumulating options now, in place of the old ones
+    for ( size_t f = 0; f < files.size(); f++ ) {
+      if ( !changed[f] )
+        continue;
+      std::vector<std::string> fileArgs{ files[f].path };
+      for ( const Entry &entry : files[f].applied ) {
+        if ( entry.option >= 0 && set.accumulates( entry.option ) )
+          appendEntryArgs( entry.content, fileArgs );
+      }
+      std::vector<OptionSet::Private::Contribution> fresh;
+      int source = set.sourceIndex( files[f].path );
+      set.collectValues( source, fileArgs, fresh );
+      set.replaceSource( source, std::move( fresh ) );
+    }
+  }
+
+  for ( int option : touched ) {
+    if ( set.accumulates( option ) ) {
+      set.rebuildOption( option );
+    } else {
+      //removed lines are not reverted, there is no earlier value to go back to
+      const Entry *last = nullptr;
+      for ( const File &file : files ) {
+        for ( const Entry &entry : file.applied ) {
+          if ( entry.option == option )
+            last = &entry;
+        }
+      }
+      if ( last )
+        appendEntryArgs( last->content, args );
+    }
+  }
+
+  if ( args.empty() )
+    return changedLines;
+
+  std::vector<char *> argv;
+  argv.reserve( args.size() + 2 );
+  argv.push_back( const_cast<char *>( files.front().path.c_str() ) );
+  for ( std::string &arg : args )
+    argv.push_back( &arg[0] );
+  argv.push_back( nullptr );
+  options.parse( argv.size() - 1, argv.data() );
+  return changedLines;
+}
+
+/**
+ * Starts watching \a files for \a options. The current content of the files is taken as
+ * already applied, load them with \sa OptionSet::loadFlagFiles under the same paths first.
+ * Changes are collected until no new event arrived for \a debounceMs milliseconds.
+ */
+FlagFileWatcher::FlagFileWatcher(OptionSet &options, const std::vector<std::string> &files, int debounceMs)
+  : d( new Private( options, debounceMs ) )
+{
+  d->fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+  if ( d->fd < 0 )
+    return;
+
+  for ( const std::string &path : files ) {
+    Private::File file;
+    file.path = path;
+    size_t slash = path.rfind( '/' );
+    file.dir  = slash == std::string::npos ? std::string(".") : path.substr( 0, slash + 1 );
+    file.name = slash == std::string::npos ? path : path.substr( slash + 1 );
+    file.wd   = inotify_add_watch( d->fd, file.dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE );
+    if ( file.wd < 0 ) {
+      close( d->fd );
+      d->fd = -1;
+      return;
+    }
+    d->readEntries( path, file.applied );
+    d->files.push_back( std::move( file ) );
+
+    //files that were not loaded before contributed nothing so far
+    OptionSet::Private &set = *options.d;
+    set.startSourceTracking();
+    int source = set.sourceIndex( path );
+    if ( std::none_of( set.contributions.begin(), set.contributions.end(), [source]( const OptionSet::Private::Contribution &c ){ return c.source == source; } ) )
+      set.contributions.push_back( OptionSet::Private::Contribution{ -1, source, boost::none } );
+  }
+}
+
+FlagFileWatcher::FlagFileWatcher(FlagFileWatcher &&other) = default;
+
+FlagFileWatcher::~FlagFileWatcher()
+{
+  if ( d && d->fd >= 0 )
+    close( d->fd );
+}
+
+/**
+ * Returns false if inotify could not be set up for all files
+ */
+bool FlagFileWatcher::isValid() const
+{
+  return d->fd >= 0;
+}
+
+/**
+ * Returns the inotify file descriptor, it becomes readable when a file changed.
+ * Use this to integrate the watcher in a event loop that calls \ref poll with a timeout of 0.
+ */
+int FlagFileWatcher::fd() const
+{
+  return d->fd;
+}
+
+/**
+ * Waits up to \a timeoutMs milliseconds for changes, -1 waits forever, and applies them.
+ * \returns the number of added, modified or removed lines, or -1 on error
+ */
+int FlagFileWatcher::poll(int timeoutMs)
+{
+  if ( d->fd < 0 )
+    return -1;
+
+  struct pollfd pfd{ d->fd, POLLIN, 0 };
+  int ready = ::poll( &pfd, 1, timeoutMs );
+  if ( ready < 0 )
+    return errno == EINTR ? 0 : -1;
+  if ( ready == 0 )
+    return 0;
+
+  std::vector<bool> changed( d->files.size(), false );
+  d->readEvents( changed );
+
+  //editors often write a file in several steps, wait until it settled
+  while ( ::poll( &pfd, 1, d->debounceMs ) > 0 )
+    d->readEvents( changed );
+
+  return d->reapply( changed );
+}
+
+Exception::Exception(const std::string what_r) : _what (what_r)
+{ }
+
+const char *Exception::what() const noexcept
+{
+  return _what.c_str();
+}
+
+/**
+ * Renders the \a options help string, the time it took is added
+ * to \a stats if it is not null. If \a scope is given only options
+ * below that dotted name are shown, e.g. "db.pool" for --help=db.pool.
+ */
+void renderHelp(const std::vector<CommandGroup> &options, ParseStats *stats, const char *scope)
+{
+  StatsTimer timer( stats ? &stats->helpNs : nullptr );
+
+  size_t scopeLen = scope ? strlen( scope ) : 0;
+  auto visible = [scope, scopeLen]( const CommandOption &opt ) {
+    return !scope || ( opt.name && isInScope( opt.name, scope, scopeLen ) );
+  };
+
+  for ( const CommandGroup &grp : options ) {
+    if ( std::none_of( grp.options.begin(), grp.options.end(), visible ) )
+      continue;
+
+    std::cout << grp.name << ":" << std::endl << std::endl;
+    for ( const CommandOption &opt : grp.options ) {
+      if ( !visible( opt ) )
+        continue;
+
+      if ( opt.shortName )
+        std::cout << "-" << opt.shortName << ", ";
+      else
+        std::cout << "    ";
+
+      std::cout << "--" << opt.name;
+
+      std::string argSyntax = opt.value.argHint();
+      if ( argSyntax.length() ) {
+        if ( opt.flags & GnuFlag::CommandOption::OptionalArgument )
+          std::cout << "[=";
+        else
+          std::cout << " <";
+        std::cout << argSyntax;
+        if ( opt.flags & GnuFlag::CommandOption::OptionalArgument )
+          std::cout << "]";
+        else
+          std::cout << ">";
+      }
+
+      std::cout << "\t" << opt.help;
+
+      auto defVal = opt.value.defaultValue();
+      if ( defVal )
+        std::cout << " Default: " << *defVal;
+
+      std::cout << std::endl;
+
+    }
+    std::cout<<std::endl;
+  }
+}
+
+namespace {
+  void appendJsonString ( std::string &out, const char *str, size_t len )
+  {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for ( size_t i = 0; i < len; i++ ) {
+      unsigned char c = str[i];
+      switch ( c ) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        default:
+          if ( c < 0x20 ) {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 0xF];
+          } else {
+            out += c;
+          }
+      }
+    }
+    out += '"';
+  }
+
+  void appendOptionName ( std::string &out, const CommandOption &opt )
+  {
+    if ( opt.name )
+      out += opt.name;
+    else
+      out += opt.shortName;
+  }
+}
+
+/**
+ * Appends the current value of all \a options to \a out, either as aligned
+ * "name = value" lines or as a single JSON object. With \a DumpChangedOnly only options
+ * whose value differs from \sa Value::defaultValue are written. Values of options
+ * flagged as \a Secret are replaced, options that can not provide their value are skipped.
+ * All values go through one scratch buffer that is reused, reserve the capacity
+ * of \a out to avoid reallocations while writing.
+ */
+void dumpConfig(const std::vector<CommandGroup> &options, std::string &out, DumpFormat format, int flags)
+{
+  size_t nameWidth = 0;
+  for ( const CommandGroup &grp : options ) {
+    for ( const CommandOption &opt : grp.options )
+      nameWidth = std::max( nameWidth, opt.name ? strlen( opt.name ) : 1 );
+  }
+
+  if ( format == DumpJson )
+    out += '{';
+
+  std::string value;
+  bool first = true;
+  for ( const CommandGroup &grp : options ) {
+    for ( const CommandOption &opt : grp.options ) {
+
+      value.clear();
+      if ( !opt.value.appendCurrentValue( value ) )
+        continue;
+
+      if ( flags & DumpChangedOnly && opt.value.isDefaultValue( value ) )
+        continue;
+
+      if ( opt.flags & CommandOption::Secret )
+        value = "***";
+
+      if ( format == DumpJson ) {
+        if ( !first )
+          out += ',';
+        out += '"';
+        appendOptionName( out, opt );
+        out += "\":";
+        appendJsonString( out, value.data(), value.size() );
+      } else {
+        size_t lineStart = out.size();
+        appendOptionName( out, opt );
+        out.append( nameWidth - ( out.size() - lineStart ), ' ' );
+        out += " = ";
+        out += value;
+        out += '\n';
+      }
+      first = false;
+    }
+  }
+
+  if ( format == DumpJson )
+    out += '}';
 }
 
 }
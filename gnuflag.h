@@ -4,8 +4,8 @@
 #include <string>
 #include <functional>
 #include <vector>
-#include <iostream>
 #include <exception>
+#include <memory>
 
 #include <boost/optional.hpp>
 
@@ -13,6 +13,27 @@ namespace GnuFlag {
 
   struct CommandOption;
 
+  /**
+   * Functions shared by all values of one type. They get the target variable passed in,
+   * so one static table serves every option of that type and copying a \sa Value only
+   * copies a pointer to it instead of another functor.
+   */
+  struct ValueOps
+  {
+    bool (*appendCurrent) ( const void *target, std::string &out ); // < appends the current value as string
+    void (*save) ( const void *target, std::string &buf );            // < serializes the target variable into buf
+    const char *(*restore) ( void *target, const char *pos, const char *end ); // < reads back what save wrote, returns the position behind it or nullptr
+    bool (*isDefault) ( const void *defaultData, const std::string &current ); // < compares a current value with the default without building it
+    void (*clear) ( void *target ); // < empties the target of a type that collects all occurrences, nullptr for types where the last one wins
+    bool repeatable; // < every occurrence is accepted even without CommandOption::Repeatable, e.g. for counting
+  };
+
+  // building blocks for ValueOps::save and ValueOps::restore, the restore functions return
+  // nullptr if \a pos is nullptr or the buffer ends before the value does
+  void saveSizeState ( std::string &buf, size_t size );
+  void saveStringState ( std::string &buf, const std::string &str );
+  const char *restoreSizeState ( const char *pos, const char *end, size_t &size );
+  const char *restoreStringState ( const char *pos, const char *end, std::string &str );
 
   class Value {
 
@@ -20,20 +41,81 @@ namespace GnuFlag {
     using DefValueFun = std::function<boost::optional<std::string>()>;
     using SetterFun   = std::function<bool ( CommandOption *, const boost::optional<std::string> &in)>;
 
-    Value ( DefValueFun &&defValue, SetterFun &&setter, const std::string argHint = std::string() );
-    bool set ( CommandOption * opt, const boost::optional<std::string> in );
+    Value ( DefValueFun &&defValue, SetterFun &&setter, const std::string argHint = std::string(), const ValueOps *ops = nullptr, void *target = nullptr,
+            const void *defaultData = nullptr );
+    bool set ( CommandOption * opt, const boost::optional<std::string> &in );
     boost::optional<std::string> defaultValue ( ) const;
+    bool appendCurrentValue ( std::string &out ) const;
+    bool isDefaultValue ( const std::string &current ) const;
+    bool accumulates ( ) const;
+    void clearTarget ( );
     std::string argHint () const;
+    void reset ( );
+
+    void saveState ( std::string &buf ) const;
+    const char *restoreState ( const char *pos, const char *end );
 
   private:
     bool _wasSet = false;
     DefValueFun _defaultVal;
     SetterFun _setter;
+    const ValueOps *_ops;
+    void *_target;
+    const void *_defaultData;
     std::string _argHint;
   };
 
   Value StringType ( std::string *target, const boost::optional<const char *> &defValue = boost::optional<const char *> (), const char * hint = "STRING" );
+  Value Utf8StringType ( std::string *target, const boost::optional<const char *> &defValue = boost::optional<const char *> (), const char * hint = "STRING" );
   Value IntType    ( int *target, const boost::optional<int> &defValue = boost::optional<int>()  );
+  Value CountType  ( int *target );
+
+  template <class Container>
+  struct StringContainerOps
+  {
+    static bool appendCurrent ( const void *target, std::string &out ) {
+      bool first = true;
+      for ( const auto &elem : *static_cast<const Container *>( target ) ) {
+        if ( !first ) out += ',';
+        out += elem;
+        first = false;
+      }
+      return true;
+    }
+    static void save ( const void *target, std::string &buf ) {
+      const Container &list = *static_cast<const Container *>( target );
+      saveSizeState( buf, list.size() );
+      for ( const auto &elem : list )
+        saveStringState( buf, elem );
+    }
+    static const char *restore ( void *target, const char *pos, const char *end ) {
+      Container &list = *static_cast<Container *>( target );
+      size_t count = 0;
+      pos = restoreSizeState( pos, end, count );
+      list.clear();
+      std::string elem;
+      for ( size_t i = 0; pos && i < count; i++ ) {
+        pos = restoreStringState( pos, end, elem );
+        if ( pos )
+          list.push_back( elem );
+      }
+      return pos;
+    }
+    static void clear ( void *target ) {
+      static_cast<Container *>( target )->clear();
+    }
+    static const ValueOps ops;
+  };
+
+  template <class Container>
+  const ValueOps StringContainerOps<Container>::ops = {
+    &StringContainerOps<Container>::appendCurrent,
+    &StringContainerOps<Container>::save,
+    &StringContainerOps<Container>::restore,
+    nullptr,
+    &StringContainerOps<Container>::clear,
+    false
+  };
 
   template <class Container>
   Value StringContainerType ( Container *target, const char * hint = "STRING"  ) {
@@ -44,11 +126,15 @@ namespace GnuFlag {
             target->push_back(*in);
             return true;
           },
-          hint
+          hint,
+          &StringContainerOps<Container>::ops,
+          target
     );
   }
 
 
+  Value GlobPathListType ( std::vector<std::string> *target, const char * hint = "PATTERN" );
+
   enum StoreFlag : int{
     StoreFalse,
     StoreTrue
@@ -73,6 +159,8 @@ namespace GnuFlag {
       ArgumentTypeMask = 0x0F,
 
       Repeatable       = 0x10, // < the argument can be repeated
+      Secret           = 0x20, // < the value is never shown in a configuration dump
+      Interpolate      = 0x40, // < ${name} in the argument is replaced by the value of option or environment variable name
     };
 
     const char *name;
@@ -82,14 +170,180 @@ namespace GnuFlag {
     const std::string help;
   };
 
+  /**
+   * Additional long name for a existing option, it shares the Value and
+   * flags with the option it points to.
+   */
+  struct OptionAlias
+  {
+    enum AliasFlags : int {
+      NoFlags    = 0,
+      Deprecated = 0x01, // < warn when the alias is used
+    };
+
+    const char *name;
+    const char *target; // < long name of the canonical option
+    const int flags;
+  };
+
   struct CommandGroup
   {
+    CommandGroup ( const std::string &name_r, const std::vector<CommandOption> &options_r, const std::vector<OptionAlias> &aliases_r = std::vector<OptionAlias>() )
+      : name( name_r ), options( options_r ), aliases( aliases_r ) { }
+
     const std::string name;
     std::vector<CommandOption> options;
+    std::vector<OptionAlias> aliases;
+  };
+
+  /**
+   * A expensive part of the application, e.g. a TLS stack or a metrics exporter, that is only
+   * initialized if one of its options was used, see \sa OptionSet::initSubsystems
+   */
+  struct Subsystem
+  {
+    enum Trigger : int {
+      WhenSupplied = 0, // < one of the options was given on the command line or in a flag file
+      WhenChanged  = 1, // < the value of one of the options differs from its default, options without a default need to be supplied
+    };
+
+    Subsystem ( const std::string &name_r, const std::vector<std::string> &options_r, std::function<void ()> &&init_r,
+                const std::vector<std::string> &dependsOn_r = std::vector<std::string>(), int trigger_r = WhenSupplied )
+      : name( name_r ), options( options_r ), init( std::move(init_r) ), dependsOn( dependsOn_r ), trigger( trigger_r ) { }
+
+    std::string name;
+    std::vector<std::string> options;   // < long names of the options that enable the subsystem
+    std::function<void ()> init;
+    std::vector<std::string> dependsOn; // < subsystems that are initialized before this one
+    int trigger;
+  };
+
+  /**
+   * Timings collected by a \sa OptionSet if statistics are enabled,
+   * all times are in nanoseconds.
+   */
+  struct ParseStats
+  {
+    struct OptionCost
+    {
+      const char *name;
+      char shortName;
+      unsigned long calls;
+      unsigned long long setterNs;
+    };
+
+    unsigned long long buildNs  = 0; // < building the lookup tables
+    unsigned long long scanNs   = 0; // < inside getopt, tokenizing and matching arguments
+    unsigned long long setterNs = 0; // < inside all Value setters
+    unsigned long long helpNs   = 0; // < rendering the help, only if passed to renderHelp
+    std::vector<OptionCost> options; // < setter cost per option, same order as the options were given
+  };
+
+  /**
+   * Fixed size ring buffer of parse events, once full the oldest events are overwritten.
+   */
+  class ParseTracer
+  {
+  public:
+    enum EventType : int {
+      ParseBegin,
+      ParseEnd,
+      OptionMatched,
+      SetterBegin,
+      SetterEnd,
+      UnknownOption,
+      MissingArgument
+    };
+
+    struct Event
+    {
+      EventType type;
+      unsigned long long timestampNs;
+      const char *name;  // < long name of the option, or nullptr
+      char shortName;
+      int argIndex;      // < index in argv the event belongs to
+    };
+
+    ParseTracer ( size_t capacity = 4096 );
+
+    void record ( EventType type, const CommandOption *opt, int argIndex );
+    void clear ( );
+    std::vector<Event> events ( ) const;
+    std::string toChromeTrace ( ) const;
+
+  private:
+    std::vector<Event> _events;
+    size_t _next = 0;
+    bool _wrapped = false;
+  };
+
+  class OptionSet
+  {
+  public:
+    OptionSet ( const std::vector<CommandGroup> &options );
+    OptionSet ( OptionSet &&other );
+    ~OptionSet ( );
+
+    int parse ( const int argc, char * const *argv );
+    bool loadFlagFiles ( const std::vector<std::string> &files );
+
+    bool isValid ( ) const;
+    std::string errorString ( ) const;
+
+    std::vector<const CommandOption *> scope ( const std::string &scope ) const;
+
+    std::string snapshot ( ) const;
+    bool restore ( const std::string &snapshot );
+
+    void setRecordHits ( bool enable );
+    bool saveProfile ( const std::string &file ) const;
+    bool loadProfile ( const std::string &file );
+
+    using StatsCallback = std::function<void ( const ParseStats &stats )>;
+    void setCollectStats ( bool enable, StatsCallback &&callback = StatsCallback() );
+    const ParseStats &stats () const;
+
+    void setTracer ( ParseTracer *tracer );
+
+    void addSubsystem ( Subsystem &&subsystem );
+    bool initSubsystems ( bool parallel = false );
+
+  private:
+    friend class FlagFileWatcher;
+    friend void captureInvocation ( const OptionSet &options, const int argc, char * const *argv, const std::vector<std::string> &flagFiles );
+    struct Private;
+    std::unique_ptr<Private> d;
+  };
+
+  class FlagFileWatcher
+  {
+  public:
+    FlagFileWatcher ( OptionSet &options, const std::vector<std::string> &files, int debounceMs = 100 );
+    FlagFileWatcher ( FlagFileWatcher &&other );
+    ~FlagFileWatcher ( );
+
+    bool isValid ( ) const;
+    int fd ( ) const;
+    int poll ( int timeoutMs );
+
+  private:
+    struct Private;
+    std::unique_ptr<Private> d;
   };
 
   int parseCLI ( const int argc, char * const *argv, const std::vector<CommandGroup> &options );
-  void renderHelp( const std::vector<CommandGroup> &options );
+  void renderHelp( const std::vector<CommandGroup> &options, ParseStats *stats = nullptr, const char *scope = nullptr );
+
+  enum DumpFormat : int {
+    DumpText,
+    DumpJson
+  };
+
+  enum DumpFlags : int {
+    DumpAll         = 0,
+    DumpChangedOnly = 0x01  // < skip options whose value equals the default value
+  };
+  void dumpConfig( const std::vector<CommandGroup> &options, std::string &out, DumpFormat format = DumpText, int flags = DumpAll );
 
 }
 
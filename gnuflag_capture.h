@@ -0,0 +1,48 @@
+#ifndef GNUFLAG_CAPTURE_H
+#define GNUFLAG_CAPTURE_H
+
+#include "gnuflag.h"
+
+#include <cstdint>
+#include <utility>
+
+namespace GnuFlag {
+
+  // kept out of gnuflag.h, only the capture tooling and replay drivers need it
+
+  /**
+   * One invocation as recorded by \sa captureInvocation
+   */
+  struct CapturedInvocation
+  {
+    std::vector<std::string> args;                          // < argv including argv[0]
+    std::vector<std::pair<std::string, std::string>> env;   // < variables listed in GNUFLAG_CAPTURE_ENV
+    std::vector<std::pair<std::string, uint64_t>> flagFiles; // < path and FNV-1a hash of the content, 0 if unreadable
+  };
+
+  /**
+   * Throughput and latency of replaying a capture, all times are in nanoseconds.
+   */
+  struct ReplayStats
+  {
+    struct Engine
+    {
+      const char *name;
+      unsigned long invocations;
+      double invocationsPerSecond;
+      unsigned long long p50Ns;
+      unsigned long long p90Ns;
+      unsigned long long p99Ns;
+      unsigned long long maxNs;
+    };
+    std::vector<Engine> engines;
+  };
+
+  void captureInvocation ( const int argc, char * const *argv, const std::vector<std::string> &flagFiles = std::vector<std::string>() );
+  void captureInvocation ( const OptionSet &options, const int argc, char * const *argv, const std::vector<std::string> &flagFiles = std::vector<std::string>() );
+  bool readCapture ( const std::string &file, std::vector<CapturedInvocation> &out );
+  ReplayStats replayCapture ( const std::vector<CapturedInvocation> &corpus, const std::vector<CommandGroup> &options, int rounds = 1 );
+
+}
+
+#endif // GNUFLAG_CAPTURE_H
@@ -0,0 +1,18 @@
+#ifndef GNUFLAG_REGEX_H
+#define GNUFLAG_REGEX_H
+
+#include "gnuflag.h"
+
+#include <memory>
+#include <regex>
+
+namespace GnuFlag {
+
+  // kept out of gnuflag.h so only users of RegexType pay for including <regex>
+  using SharedRegex = std::shared_ptr<const std::regex>;
+
+  Value RegexType ( SharedRegex *target, std::regex::flag_type flags = std::regex::ECMAScript | std::regex::optimize, const char * hint = "REGEX" );
+
+}
+
+#endif // GNUFLAG_REGEX_H
@@ -1,5 +1,5 @@
 TEMPLATE = app
-CONFIG += console c++11
+CONFIG += console c++11 thread
 CONFIG -= app_bundle
 CONFIG -= qt
 
@@ -7,4 +7,6 @@ SOURCES += main.cpp \
     gnuflag.cpp
 
 HEADERS += \
-    gnuflag.h
+    gnuflag.h \
+    gnuflag_regex.h \
+    gnuflag_capture.h
@@ -8,11 +8,13 @@ int main( int argc, char *argv[])
   std::vector<std::string> stringVec;
   bool myFlag = false;
   int myInt = 10;
+  int verbosity = 0;
 
   std::vector<GnuFlag::CommandGroup> options {
     {"Default", {
         { "int", 'i', GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &myInt, myInt) , "Set the Int value." },
-        { "bool", 'b', GnuFlag::CommandOption::NoArgument , GnuFlag::BoolType( &myFlag, GnuFlag::StoreTrue, myFlag) , "Enable the bool switch." }
+        { "bool", 'b', GnuFlag::CommandOption::NoArgument , GnuFlag::BoolType( &myFlag, GnuFlag::StoreTrue, myFlag) , "Enable the bool switch." },
+        { "verbose", 'v', GnuFlag::CommandOption::NoArgument, GnuFlag::CountType( &verbosity ) , "Increase the verbosity, can be repeated." }
       }
     }, { "Extended", {
         { "string", 's', GnuFlag::CommandOption::RequiredArgument, GnuFlag::StringType( &myStringVar, myStringVar.c_str() ) , "Set the String value." },
@@ -31,7 +33,8 @@ int main( int argc, char *argv[])
             << "myStringVar: "<<myStringVar << std::endl
             << "optionalVar: "<<optionalVar << std::endl
             << "myFlag:      "<<myFlag << std::endl
-            << "myInt:       "<<myInt  << std::endl;
+            << "myInt:       "<<myInt  << std::endl
+            << "verbosity:   "<<verbosity << std::endl;
 
   std::cout << "container:   "<< std::endl;
   for ( const std::string &str : stringVec ){
@@ -0,0 +1,249 @@
+#include "gnuflag.h"
+#include "gnuflag_capture.h"
+#include "gnuflag_regex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * Regression tests for behaviour that is easy to break without noticing. Every test
+ * is a function that reports failed checks, the program fails if any check did.
+ */
+
+namespace {
+
+  int failures = 0;
+
+#define CHECK( cond ) \
+  do { \
+    if ( !( cond ) ) { \
+      printf( "FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond ); \
+      failures++; \
+    } \
+  } while ( 0 )
+
+  /**
+   * Mutable argv as required by getopt
+   */
+  struct Argv
+  {
+    Argv ( std::vector<std::string> args ) : _args( std::move( args ) )
+    {
+      for ( std::string &arg : _args )
+        _ptrs.push_back( &arg[0] );
+      _ptrs.push_back( nullptr );
+    }
+    int argc ( ) { return _ptrs.size() - 1; }
+    char **argv ( ) { return _ptrs.data(); }
+
+  private:
+    std::vector<std::string> _args;
+    std::vector<char *> _ptrs;
+  };
+
+  /**
+   * A directory below /tmp that is removed again with everything in it
+   */
+  struct TempDir
+  {
+    TempDir ( )
+    {
+      char tmpl[] = "/tmp/gnuflagtests-XXXXXX";
+      path = mkdtemp( tmpl ) ? tmpl : "";
+    }
+    ~TempDir ( )
+    {
+      if ( !path.empty() )
+        system( ( "rm -rf '" + path + "'" ).c_str() );
+    }
+    std::string path;
+  };
+
+  void writeFile ( const std::string &path, const std::string &content )
+  {
+    std::ofstream out( path, std::ios::trunc );
+    out << content;
+  }
+
+  /**
+   * Editing a watched flag file must only replace the values that came from it,
+   * values of accumulating options given on the command line stay.
+   */
+  void watcherKeepsCommandLineValues ( )
+  {
+    TempDir dir;
+    std::string file = dir.path + "/flags";
+    writeFile( file, "item=a\nitem=b\nverbose\n" );
+
+    std::vector<std::string> items;
+    int verbose = 0;
+    std::vector<GnuFlag::CommandGroup> options { GnuFlag::CommandGroup{ "Test", {
+      { "item", 0, GnuFlag::CommandOption::RequiredArgument | GnuFlag::CommandOption::Repeatable, GnuFlag::StringContainerType( &items ), "" },
+      { "verbose", 'v', GnuFlag::CommandOption::NoArgument, GnuFlag::CountType( &verbose ), "" }
+    } } };
+
+    GnuFlag::OptionSet set( options );
+    CHECK( set.loadFlagFiles( { file } ) );
+    Argv args( { "test", "--item=cli", "-vv" } );
+    set.parse( args.argc(), args.argv() );
+    CHECK( ( items == std::vector<std::string>{ "a", "b", "cli" } ) );
+    CHECK( verbose == 3 );
+
+    GnuFlag::FlagFileWatcher watcher( set, { file }, 10 );
+    CHECK( watcher.isValid() );
+    writeFile( file, "item=a\nitem=c\nverbose\nverbose\n" );
+    CHECK( watcher.poll( 2000 ) > 0 );
+    CHECK( ( items == std::vector<std::string>{ "a", "c", "cli" } ) );
+    CHECK( verbose == 4 );
+
+    writeFile( file, "verbose\n" );
+    CHECK( watcher.poll( 2000 ) > 0 );
+    CHECK( ( items == std::vector<std::string>{ "cli" } ) );
+    CHECK( verbose == 3 );
+  }
+
+  /**
+   * A "name value" line in a flag file is one option with its value, also for options
+   * with a optional value. A line that is not a option does not stop the rest of the file.
+   */
+  void flagFileLinesWithBlanks ( )
+  {
+    TempDir dir;
+    std::string file = dir.path + "/flags";
+    writeFile( file, "ostring some value\n-\nstring later\n-n 5\n" );
+
+    std::string ostring, string;
+    int number = 0;
+    std::vector<GnuFlag::CommandGroup> options { GnuFlag::CommandGroup{ "Test", {
+      { "ostring", 0, GnuFlag::CommandOption::OptionalArgument, GnuFlag::StringType( &ostring, "default" ), "" },
+      { "string", 0, GnuFlag::CommandOption::RequiredArgument, GnuFlag::StringType( &string ), "" },
+      { "number", 'n', GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &number ), "" }
+    } } };
+
+    GnuFlag::OptionSet set( options );
+    CHECK( !set.loadFlagFiles( { file } ) );
+    CHECK( ostring == "some value" );
+    CHECK( string == "later" );
+    CHECK( number == 5 );
+  }
+
+  /**
+   * Replaying a capture must leave the variables of the program as they were
+   */
+  void replayRestoresTargets ( )
+  {
+    std::string password = "orig";
+    int number = 7;
+    std::vector<std::string> items{ "x" };
+    std::vector<GnuFlag::CommandGroup> options { GnuFlag::CommandGroup{ "Test", {
+      { "password", 'p', GnuFlag::CommandOption::RequiredArgument | GnuFlag::CommandOption::Secret, GnuFlag::StringType( &password ), "" },
+      { "item", 0, GnuFlag::CommandOption::RequiredArgument | GnuFlag::CommandOption::Repeatable, GnuFlag::StringContainerType( &items ), "" },
+      { "number", 'n', GnuFlag::CommandOption::RequiredArgument, GnuFlag::IntType( &number ), "" }
+    } } };
+
+    GnuFlag::CapturedInvocation invocation;
+    invocation.args = { "test", "--password=***", "--item=a", "-n", "3" };
+    GnuFlag::ReplayStats stats = GnuFlag::replayCapture( { invocation }, options, 100 );
+    CHECK( stats.engines.size() == 2 );
+    CHECK( password == "orig" );
+    CHECK( number == 7 );
+    CHECK( ( items == std::vector<std::string>{ "x" } ) );
+  }
+
+  /**
+   * Short option names above 0x7f are returned as negative values by getopt
+   */
+  void highShortOption ( )
+  {
+    bool flag = false;
+    std::vector<GnuFlag::CommandGroup> options { GnuFlag::CommandGroup{ "Test", {
+      { "flag", '\xe9', GnuFlag::CommandOption::NoArgument, GnuFlag::BoolType( &flag ), "" }
+    } } };
+
+    Argv args( { "test", "-\xe9" } );
+    CHECK( GnuFlag::parseCLI( args.argc(), args.argv(), options ) == 2 );
+    CHECK( flag );
+  }
+
+  /**
+   * Directories found while expanding "**" can contain characters glob treats as special
+   */
+  void globstarSpecialDirectoryNames ( )
+  {
+    TempDir dir;
+    for ( const char *sub : { "/g", "/g/a[1]", "/g/b*?", "/g/b*?/c\\d" } )
+      mkdir( ( dir.path + sub ).c_str(), 0755 );
+    writeFile( dir.path + "/g/top.txt", "" );
+    writeFile( dir.path + "/g/a[1]/x.txt", "" );
+    writeFile( dir.path + "/g/b*?/c\\d/y.txt", "" );
+
+    std::vector<std::string> paths;
+    std::vector<GnuFlag::CommandGroup> options { GnuFlag::CommandGroup{ "Test", {
+      { "files", 0, GnuFlag::CommandOption::RequiredArgument, GnuFlag::GlobPathListType( &paths ), "" }
+    } } };
+
+    Argv args( { "test", "--files=" + dir.path + "/g/**/*.txt" } );
+    GnuFlag::parseCLI( args.argc(), args.argv(), options );
+    std::sort( paths.begin(), paths.end() );
+    CHECK( ( paths == std::vector<std::string>{ dir.path + "/g/a[1]/x.txt", dir.path + "/g/b*?/c\\d/y.txt", dir.path + "/g/top.txt" } ) );
+  }
+
+  /**
+   * References that can not be expanded leave the option unset and every such option is named
+   */
+  void interpolationFailuresAreReported ( )
+  {
+    std::string a = "-", b = "-", c = "-", d = "-";
+    GnuFlag::SharedRegex re;
+    std::vector<GnuFlag::CommandGroup> options { GnuFlag::CommandGroup{ "Test", {
+      { "a", 0, GnuFlag::CommandOption::RequiredArgument | GnuFlag::CommandOption::Interpolate, GnuFlag::StringType( &a ), "" },
+      { "b", 0, GnuFlag::CommandOption::RequiredArgument | GnuFlag::CommandOption::Interpolate, GnuFlag::StringType( &b ), "" },
+      { "c", 0, GnuFlag::CommandOption::RequiredArgument | GnuFlag::CommandOption::Interpolate, GnuFlag::StringType( &c ), "" },
+      { "d", 0, GnuFlag::CommandOption::RequiredArgument | GnuFlag::CommandOption::Interpolate, GnuFlag::StringType( &d ), "" },
+      { "re", 0, GnuFlag::CommandOption::RequiredArgument, GnuFlag::RegexType( &re ), "" }
+    } } };
+
+    std::ostringstream errors;
+    std::streambuf *cerrBuf = std::cerr.rdbuf( errors.rdbuf() );
+    Argv args( { "test", "--re=x+", "--a=${b}", "--b=${a}", "--c=[${re}]", "--d=<${a}>" } );
+    GnuFlag::parseCLI( args.argc(), args.argv(), options );
+    std::cerr.rdbuf( cerrBuf );
+
+    CHECK( a == "-" );
+    CHECK( b == "-" );
+    CHECK( c == "-" );
+    CHECK( d == "-" );
+    const std::string text = errors.str();
+    CHECK( text.find( "values of a b" ) != std::string::npos );
+    CHECK( text.find( "Option re referenced in the value of c" ) != std::string::npos );
+    CHECK( text.find( "Value of d not applied" ) != std::string::npos );
+  }
+}
+
+int main ( )
+{
+  const std::vector<std::pair<const char *, std::function<void()>>> tests {
+    { "watcherKeepsCommandLineValues", watcherKeepsCommandLineValues },
+    { "flagFileLinesWithBlanks", flagFileLinesWithBlanks },
+    { "replayRestoresTargets", replayRestoresTargets },
+    { "highShortOption", highShortOption },
+    { "globstarSpecialDirectoryNames", globstarSpecialDirectoryNames },
+    { "interpolationFailuresAreReported", interpolationFailuresAreReported }
+  };
+
+  for ( const auto &test : tests ) {
+    int before = failures;
+    test.second();
+    printf( "%s %s\n", failures == before ? "PASS" : "FAIL", test.first );
+  }
+  return failures ? 1 : 0;
+}
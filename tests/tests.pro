@@ -0,0 +1,19 @@
+TEMPLATE = app
+TARGET = gnuflagtests
+CONFIG += console c++11 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ..
+
+SOURCES += gnuflagtests.cpp \
+    ../gnuflag.cpp
+
+HEADERS += \
+    ../gnuflag.h \
+    ../gnuflag_regex.h \
+    ../gnuflag_capture.h
+
+# "make check" runs all tests and fails if one of them does
+check.commands = ./$$TARGET
+QMAKE_EXTRA_TARGETS += check